@@ -0,0 +1,274 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "node.hpp"
+#include "mcts.hpp"
+#include "server.hpp"
+#include "misc.hpp"
+#include "config.hpp"
+
+
+// input  : one position per line "<black bitboard (hex)> <white bitboard (hex)> <side (b/w)>"
+// output : one JSON object per line, or result_t records with --binary
+//          (results are written in order of completion, use index to match inputs)
+
+typedef struct {
+    BitBoard black_bitboard;
+    BitBoard white_bitboard;
+    Side side;
+} position_t;
+
+typedef struct {
+    int index;  // line number in input (0-origin)
+    BitBoard black_bitboard;
+    BitBoard white_bitboard;
+    Side side;
+    Action action;  // best action (SpetialAction::INVALID if terminal)
+    float Q;  // search value from the viewpoint of side
+    float value;  // raw NN value (game result if terminal)
+    int visits[64];  // visit count of each action (index 0 if pass)
+} result_t;
+
+namespace {
+
+std::mutex output_mutex;
+std::atomic<int> next_index(0);
+std::atomic<int> n_done(0);
+
+bool read_positions(const char *fname, std::vector<position_t>& positions) {
+    std::ifstream ifs(fname);
+    if (ifs.fail()) {
+        fprintf(stderr, "cannot open file \"%s\"\n", fname);
+        return false;
+    }
+    std::string line;
+    int line_count = 0;
+    while (std::getline(ifs, line)) {
+        line_count++;
+        std::istringstream iss(line);
+        position_t position;
+        std::string side;
+        if (!(iss >> std::hex >> position.black_bitboard >> position.white_bitboard >> side) || (side != "b" && side != "w")) {
+            fprintf(stderr, "invalid position at line %d: \"%s\"\n", line_count, line.c_str());
+            return false;
+        }
+        position.side = (side == "b") ? Side::BLACK : Side::WHITE;
+        positions.push_back(position);
+    }
+    return true;
+}
+
+void analyze_position(const position_t& position, int server_sock, result_t& result) {
+    const auto& config = get_config();
+
+    Board board(position.black_bitboard, position.white_bitboard);
+    GameNode *root = new GameNode(board, position.side, 0);
+    root->expand(server_sock);
+    root->backpropagete(root->value(), root);
+
+    result.black_bitboard = position.black_bitboard;
+    result.white_bitboard = position.white_bitboard;
+    result.side = position.side;
+    result.action = SpetialAction::INVALID;
+    memset(result.visits, 0, sizeof(result.visits));
+    result.value = root->value();
+
+    if (!root->terminal()) {
+        for (int sim_count = 0; sim_count < config.n_simulation && !root->solved(); sim_count++) {
+            simulate(root, server_sock);
+        }
+        std::default_random_engine engine;  // not used for tau = 0
+        root->next_node(/*tau=*/0.0, engine);
+        result.action = root->action();
+        const auto& children = root->children();
+        for (unsigned int i = 0; i < children.size(); i++) {
+            Action action = root->pass() ? 0 : root->legal_actions()[i];
+            result.visits[action] = children[i]->N();
+        }
+    }
+    result.Q = root->Q();
+
+    safe_delete(root);  // delete root -> whole tree
+}
+
+void write_result(std::ostream& os, const result_t& result, bool binary) {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    if (binary) {
+        os.write(reinterpret_cast<const char*>(&result), sizeof(result_t));
+        return;
+    }
+    os << "{\"index\":" << result.index
+        << ",\"black\":\"" << std::hex << result.black_bitboard
+        << "\",\"white\":\"" << result.white_bitboard << std::dec
+        << "\",\"side\":\"" << result.side
+        << "\",\"action\":\"" << result.action
+        << "\",\"Q\":" << result.Q
+        << ",\"value\":" << result.value
+        << ",\"visits\":{";
+    bool first = true;
+    for (int i = 0; i < 64; i++) {
+        if (result.visits[i] > 0) {
+            Action action = (result.action == SpetialAction::PASS) ? (Action)SpetialAction::PASS : (Action)i;
+            os << (first ? "" : ",") << "\"" << action << "\":" << result.visits[i];
+            first = false;
+        }
+    }
+    os << "}}\n";
+}
+
+void analyze_positions(int thread_id, const std::vector<position_t>& positions, std::ostream& os, bool binary) {
+    int server_sock = connect_to_server();  // NN server
+
+    auto start = std::chrono::system_clock::now();
+
+    while (true) {
+        int index = next_index++;
+        if (index >= (int)positions.size()) {
+            break;
+        }
+        result_t result;
+        result.index = index;
+        analyze_position(positions[index], server_sock, result);
+        write_result(os, result, binary);
+
+        int done = ++n_done;
+        if (thread_id == 0 && done % 100 == 0) {
+            auto end = std::chrono::system_clock::now();
+            float elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() * 1e-3;
+            fprintf(stderr, "%d / %ld positions (%.1f positions/sec)\n", done, positions.size(), done / elapsed);
+        }
+    }
+
+    disconnect_from_server(server_sock);
+}
+
+}  // namespace
+
+
+int main(int argc, char *argv[]) {
+    if ((argc < 4) || (argc > 4 && argv[4][0] != '-')) {
+        fprintf(stderr, "Usage: analyze exp_id input_file output_file [--generation=G] [--n_simulation=N] [--n_thread=T] [--device_id=ID] [--binary] [--server=ADDRESS] [--priority=high|low]\n");
+        exit(-1);
+    }
+    int exp_id = atoi(argv[1]);
+    const char *input_fname = argv[2];
+    const char *output_fname = argv[3];
+    std::cout << "exp_id = " << exp_id << std::endl;
+
+    char exp_path[100];
+    get_exp_path(argv[0], exp_id, exp_path);
+    std::cout << "exp_path = " << exp_path << std::endl;
+
+    int generation = -1;  // if -1 select best model
+    int n_simulation = 400;
+    int n_thread = std::thread::hardware_concurrency();
+    int device_id = 0;
+    bool binary = false;
+    const char *server_address = NULL;  // if set, requests go to a shared inference server
+    int priority = PRIORITY_LOW;  // bulk analysis fills batches like self-play
+
+    int opt, longindex;
+    const struct option longopts[] = {
+        {"generation", required_argument, NULL, 'g'},
+        {"n_simulation", required_argument, NULL, 'n'},
+        {"n_thread", required_argument, NULL, 't'},
+        {"device_id", required_argument, NULL, 'd'},
+        {"binary", no_argument, NULL, 'b'},
+        {"server", required_argument, NULL, 'a'},
+        {"priority", required_argument, NULL, 'p'},
+        {0, 0, 0, 0}
+    };
+    while ((opt = getopt_long(argc, argv, "g:n:t:d:ba:p:", longopts, &longindex)) != -1) {
+        switch (opt) {
+            case 'g':
+                generation = atoi(optarg);
+                break;
+            case 'n':
+                n_simulation = atoi(optarg);
+                break;
+            case 't':
+                n_thread = atoi(optarg);
+                break;
+            case 'd':
+                device_id = atoi(optarg);
+                break;
+            case 'b':
+                binary = true;
+                break;
+            case 'a':
+                server_address = optarg;
+                break;
+            case 'p':
+                if (strcmp(optarg, "high") == 0) {
+                    priority = PRIORITY_HIGH;
+                } else if (strcmp(optarg, "low") == 0) {
+                    priority = PRIORITY_LOW;
+                } else {
+                    fprintf(stderr, "unknown priority \"%s\"\n", optarg);
+                    exit(-1);
+                }
+                break;
+            default:
+                fprintf(stderr, "unknown option\n");
+                exit(-1);
+        }
+    }
+    std::cout << "generation = " << generation << std::endl;
+    std::cout << "n_simulation = " << n_simulation << std::endl;
+    std::cout << "n_thread = " << n_thread << std::endl;
+    std::cout << "device_id = " << device_id << std::endl;
+    std::cout << "priority = " << (priority == PRIORITY_HIGH ? "high" : "low") << std::endl;
+
+    std::vector<position_t> positions;
+    if (!read_positions(input_fname, positions)) {
+        exit(-1);
+    }
+    std::cout << "positions = " << positions.size() << std::endl;
+
+    std::ofstream ofs(output_fname, binary ? std::ios::binary : std::ios::out);
+    if (ofs.fail()) {
+        fprintf(stderr, "cannot open file \"%s\"\n", output_fname);
+        exit(-1);
+    }
+
+    init_config(exp_path, generation, device_id);
+    // overwrite experiment configuration
+    set_config(n_thread, n_simulation, /*e_frac=*/0.0);
+    if (server_address != NULL) {  // inference server started by inference_server (see README)
+        std::cout << "server = " << server_address << std::endl;
+        set_server_address(server_address);
+    }
+    set_priority(priority);
+
+    auto start = std::chrono::system_clock::now();
+
+    pid_t server_pid = create_server_process();
+    (void)server_pid;
+
+    std::vector<std::thread> client_threads(n_thread);
+    for (int i = 0; i < n_thread; i++) {
+        client_threads[i] = std::thread(analyze_positions, i, std::cref(positions), std::ref(ofs), binary);
+    }
+    for (int i = 0; i < n_thread; i++) {
+        client_threads[i].join();
+    }
+    ofs.close();
+
+    auto end = std::chrono::system_clock::now();
+    float elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() * 1e-3;
+    printf("analyzed %ld positions in %.2f sec (%.1f positions/sec)\n", positions.size(), elapsed, positions.size() / elapsed);
+
+    return 0;
+}
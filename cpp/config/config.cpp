@@ -13,6 +13,25 @@ namespace {
 config_t config;
 std::random_device seed_gen;
 std::default_random_engine engine(seed_gen());
+
+void get_model_fname(const char *exp_path, int generation, char *model_fname) {
+    if (generation >= 0) {
+        sprintf(model_fname, "%s/model/model_jit_%d.pt", exp_path, generation);
+    } else {
+        sprintf(model_fname, "%s/model/model_jit_best.pt", exp_path);
+    }
+}
+
+double get_optional(picojson::object& obj, const char *key, double default_value) {
+    if (obj.count(key) == 0) {
+        return default_value;
+    }
+    return obj[key].get<double>();
+}
+
+void get_optional_string(picojson::object& obj, const char *key, const char *default_value, char *value, size_t size) {
+    snprintf(value, size, "%s", (obj.count(key) == 0) ? default_value : obj[key].get<std::string>().c_str());
+}
 }
 
 void init_config(const char *exp_path, int generation, int device_id) {
@@ -45,26 +64,45 @@ void init_config(const char *exp_path, int generation, int device_id) {
 
     config.board_size = (int)obj["board_size"].get<double>();
     config.n_action = (int)obj["n_action"].get<double>();
-    config.n_res_block = (int)obj["n_res_block"].get<double>();
-    config.res_filter = (int)obj["res_filter"].get<double>();
-    config.policy_filter = (int)obj["policy_filter"].get<double>();
-    config.value_filter = (int)obj["value_filter"].get<double>();
-    config.value_hidden = (int)obj["value_hidden"].get<double>();
-    // printf("board_size=%d n_action=%d n_res_block=%d res_filter=%d value_hidden=%d\n", config.board_size, config.n_action, config.n_res_block, config.res_filter, config.value_hidden);
+    config.small_depth = (int)get_optional(obj, "small_depth", 0);
+    config.small_visits = (int)get_optional(obj, "small_visits", 0);
+    // printf("board_size=%d n_action=%d\n", config.board_size, config.n_action);
 
     config.n_game = (int)obj["n_game"].get<double>();
     config.n_thread = (int)obj["n_thread"].get<double>();
     config.n_simulation = (int)obj["n_simulation"].get<double>();
+    config.n_speculative = (int)get_optional(obj, "n_speculative", 0);
+    config.max_latency_usec = (int)get_optional(obj, "max_latency_usec", 2000);
+    config.batch_bucket = (int)get_optional(obj, "batch_bucket", 1);
+    config.n_worker = (int)get_optional(obj, "n_worker", 1);
+    config.n_intra_thread = (int)get_optional(obj, "n_intra_thread", 0);
+    config.wire_fp16 = (int)get_optional(obj, "wire_fp16", 0);
+    config.priority = PRIORITY_LOW;
+    config.reserved_rows = (int)get_optional(obj, "reserved_rows", 0);
+    config.reserved_buffers = (int)get_optional(obj, "reserved_buffers", 0);
+    get_optional_string(obj, "metrics_file", "", config.metrics_fname, sizeof(config.metrics_fname));
+    config.metrics_interval_sec = (int)get_optional(obj, "metrics_interval_sec", 10);
+    get_optional_string(obj, "metrics_address", "", config.metrics_address, sizeof(config.metrics_address));
+    get_optional_string(obj, "trace_file", "", config.trace_fname, sizeof(config.trace_fname));
+    config.model_watch_msec = (int)get_optional(obj, "model_watch_msec", 0);
+    config.transport = TRANSPORT_SOCKET;
+    if (obj.count("transport") && obj["transport"].get<std::string>() == "shm") {
+        config.transport = TRANSPORT_SHM;
+    } else if (obj.count("transport") && obj["transport"].get<std::string>() == "inproc") {
+        config.transport = TRANSPORT_INPROC;
+    }
     // printf("n_game=%d n_thread=%d n_simulation=%d\n", config.n_game, config.n_thread, config.n_simulation);
 
     config.device_id = device_id;
+    config.evaluator = EVALUATOR_NETWORK;
+    config.n_heuristic_generation = (int)get_optional(obj, "n_heuristic_generation", 0);
 
-    if (generation >= 0) {
-        sprintf(config.model_fname, "%s/model/model_jit_%d.pt", exp_path, generation);
-    } else {
-        sprintf(config.model_fname, "%s/model/model_jit_best.pt", exp_path);
-    }
+    get_model_fname(exp_path, generation, config.model_fname);
+    sprintf(config.small_model_fname, "%s/model/small_model_jit_best.pt", exp_path);
     // printf("model_fname=%s\n", config.model_fname);
+    config.server_address[0] = '\0';
+    config.n_player = 1;
+    strcpy(config.player_model_fnames[0], config.model_fname);
 }
 
 const config_t& get_config() {
@@ -76,3 +114,35 @@ void set_config(int n_thread, int n_simulation, float e_frac) {
     config.n_simulation = n_simulation;
     config.e_frac = e_frac;
 }
+
+void set_evaluator(int evaluator) {
+    config.evaluator = evaluator;
+}
+
+// model of another generation served along with model of config (generation -1: best model)
+int add_player(const char *exp_path, int generation) {
+    if (config.n_player >= MAX_PLAYER) {
+        fprintf(stderr, "too many players (max %d)\n", MAX_PLAYER);
+        exit(-1);
+    }
+    get_model_fname(exp_path, generation, config.player_model_fnames[config.n_player]);
+    return config.n_player++;
+}
+
+// requests go over socket to a server of another process or machine
+void set_server_address(const char *address) {
+    if (strlen(address) >= sizeof(config.server_address)) {
+        fprintf(stderr, "server address too long \"%s\"\n", address);
+        exit(-1);
+    }
+    strcpy(config.server_address, address);
+    config.transport = TRANSPORT_SOCKET;
+}
+
+void set_transport(int transport) {
+    config.transport = transport;
+}
+
+void set_priority(int priority) {
+    config.priority = priority;
+}
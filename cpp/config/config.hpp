@@ -1,3 +1,16 @@
+#define EVALUATOR_NETWORK 0  // NN on inference server
+#define EVALUATOR_HEURISTIC 1  // handcrafted evaluator in client process (no server)
+
+#define TRANSPORT_SOCKET 0  // requests and responses over unix socket
+#define TRANSPORT_SHM 1  // requests and responses in shared memory (socket is kept for connection management)
+#define TRANSPORT_INPROC 2  // inference thread in client process (no server process)
+
+#define PRIORITY_LOW 0  // bulk traffic (self-play, reanalyse, match)
+#define PRIORITY_HIGH 1  // interactive traffic (play, analyze), closes a batch as soon as it arrives
+#define N_PRIORITY 2
+
+#define MAX_PLAYER 4  // models served at once for model-vs-model matches
+
 typedef struct {
     float tau;
     float c_puct;
@@ -7,19 +20,42 @@ typedef struct {
 
     int board_size;
     int n_action;
-    int n_res_block;
-    int res_filter;
-    int policy_filter;
-    int value_filter;
-    int value_hidden;
+    int small_depth;  // evaluate leaves at least this deep with the small model (0: disabled)
+    int small_visits;  // evaluate leaves whose parent has fewer visits with the small model (0: disabled)
 
     int n_game;
     int n_thread;
     int n_simulation;
+    int n_speculative;  // children of an expanded node evaluated in spare rows of a batch (0: disabled)
+    int max_latency_usec;  // upper bound of server-side latency of a request (batch wait + forward)
+    int batch_bucket;  // pad batches to power-of-two sizes (padding rows are used for speculative inputs)
+    int transport;
+    int n_worker;  // inference workers (model replicas) in server process
+    int n_intra_thread;  // intra-op threads of the server process, shared by workers (0: default of libtorch)
+    int wire_fp16;  // priors are sent as fp16 over socket
+    int priority;  // class of requests of this process
+    int reserved_rows;  // rows of each batch only high-priority requests may fill
+    int reserved_buffers;  // staging buffers of server only high-priority batches may use
+    char metrics_fname[100];  // server metrics are written to this file (empty: disabled)
+    int metrics_interval_sec;
+    char metrics_address[100];  // Prometheus text endpoint ("host:port" or unix socket path, empty: disabled)
+    char trace_fname[100];  // requests of client threads are recorded to this file for server_bench (empty: disabled)
+    int model_watch_msec;  // reload models when their files are modified, checked at this interval (0: only on SIGHUP)
     int device_id;
+    int evaluator;
+    int n_heuristic_generation;  // generations evaluated by heuristic evaluator
     char model_fname[100];
+    char small_model_fname[100];
+    char server_address[100];  // inference server started elsewhere ("host:port" or unix socket path, empty: own server)
+    int n_player;
+    char player_model_fnames[MAX_PLAYER][100];  // model of each player (player 0: model_fname)
 } config_t;
 
 void init_config(const char *exp_path, int generation, int device_id);
 const config_t& get_config();
 void set_config(int n_thread, int n_simulation, float e_frac);
+void set_evaluator(int evaluator);
+int add_player(const char *exp_path, int generation);  // return player id
+void set_server_address(const char *address);
+void set_transport(int transport);
+void set_priority(int priority);
@@ -0,0 +1,74 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "server.hpp"
+#include "misc.hpp"
+#include "config.hpp"
+
+
+// standalone inference server for self-play clients of other processes or machines
+// (main exp_id generation --server=ADDRESS), clients may join and leave at any time
+
+
+int main(int argc, char *argv[]) {
+    if ((argc < 2) || (argc > 2 && argv[2][0] != '-')) {
+        fprintf(stderr, "Usage: inference_server exp_id [--generation=G] [--address=ADDRESS] [--batch_size=B] [--device_id=ID]\n");
+        exit(-1);
+    }
+    int exp_id = atoi(argv[1]);
+    std::cout << "exp_id = " << exp_id << std::endl;
+
+    char exp_path[100];
+    get_exp_path(argv[0], exp_id, exp_path);
+    std::cout << "exp_path = " << exp_path << std::endl;
+
+    int generation = -1;  // if -1 select best model
+    char address[100] = "0.0.0.0:7000";  // "host:port" or path of unix socket
+    int batch_size = -1;  // if -1 n_thread of config
+    int device_id = 0;
+
+    int opt, longindex;
+    const struct option longopts[] = {
+        {"generation", required_argument, NULL, 'g'},
+        {"address", required_argument, NULL, 'a'},
+        {"batch_size", required_argument, NULL, 'b'},
+        {"device_id", required_argument, NULL, 'd'},
+        {0, 0, 0, 0}
+    };
+    while ((opt = getopt_long(argc, argv, "g:a:b:d:", longopts, &longindex)) != -1) {
+        switch (opt) {
+            case 'g':
+                generation = atoi(optarg);
+                break;
+            case 'a':
+                snprintf(address, sizeof(address), "%s", optarg);
+                break;
+            case 'b':
+                batch_size = atoi(optarg);
+                break;
+            case 'd':
+                device_id = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "unknown option\n");
+                exit(-1);
+        }
+    }
+
+    init_config(exp_path, generation, device_id);
+    const auto& config = get_config();
+    // overwrite experiment configuration (n_thread is the max rows of a batch in server)
+    set_config((batch_size > 0) ? batch_size : config.n_thread, config.n_simulation, config.e_frac);
+    set_transport(TRANSPORT_SOCKET);  // shared memory is only used with a forked server
+    std::cout << "generation = " << generation << std::endl;
+    std::cout << "address = " << address << std::endl;
+    std::cout << "batch_size = " << config.n_thread << std::endl;
+    std::cout << "device_id = " << device_id << std::endl;
+
+    run_standalone_server(address);
+
+    return 0;
+}
@@ -18,7 +18,7 @@ void collect_mldata(int thread_id, int n_game, const char *fname) {
 
     if (access(fname, F_OK) != -1) {
         fprintf(stderr, "ERROR: data file %s already exists\n", fname);
-        close(server_sock);
+        disconnect_from_server(server_sock);
         return;
     }
 
@@ -47,17 +47,17 @@ void collect_mldata(int thread_id, int n_game, const char *fname) {
             auto end = std::chrono::system_clock::now();
             int elapsed = std::chrono::duration_cast<std::chrono::seconds>(end - start).count();
             float remaining = (float)(elapsed) / (i + 1) * (n_game - i - 1) / 60;
-            printf("[%3d] i=%d (%d sec) result=%.3f remaining~%.2f min\n", thread_id, i, elapsed, result, remaining);
+            printf("[%3d] i=%d (%d sec) result=%.3f model=%d remaining~%.2f min\n", thread_id, i, elapsed, result, get_model_generation(), remaining);
         }
     }
 
-    close(server_sock);
+    disconnect_from_server(server_sock);
 }
 
 
 int main(int argc, char *argv[]) {
     if ((argc < 3) || (argc > 3 && argv[3][0] != '-')) {
-        std::cerr << "Usage: main exp_id generation [--device_id=ID]" << std::endl;
+        std::cerr << "Usage: main exp_id generation [--device_id=ID] [--server=ADDRESS]" << std::endl;
         exit(-1);
     }
     int exp_id = atoi(argv[1]);
@@ -70,17 +70,22 @@ int main(int argc, char *argv[]) {
     std::cout << "exp_path = " << exp_path << std::endl;
 
     int device_id = 0;
+    const char *server_address = NULL;  // if set, only clients run in this process
 
     int opt, longindex;
     const struct option longopts[] = {
         {"device_id", required_argument, NULL, 'd'},
+        {"server", required_argument, NULL, 's'},
         {0, 0, 0, 0}
     };
-    while ((opt = getopt_long(argc, argv, "d:", longopts, &longindex)) != -1) {
+    while ((opt = getopt_long(argc, argv, "d:s:", longopts, &longindex)) != -1) {
         switch (opt) {
             case 'd':
                 device_id = atoi(optarg);
                 break;
+            case 's':
+                server_address = optarg;
+                break;
             default:
                 fprintf(stderr, "unknown option\n");
                 exit(-1);
@@ -89,7 +94,15 @@ int main(int argc, char *argv[]) {
     std::cout << "device_id = " << device_id << std::endl;
 
     init_config(exp_path, /*generation=*/-1, device_id);  // use best model
+    if (server_address != NULL) {  // inference server started by inference_server (see README)
+        std::cout << "server = " << server_address << std::endl;
+        set_server_address(server_address);
+    }
     const auto& config = get_config();
+    if (generation < config.n_heuristic_generation) {
+        std::cout << "evaluator = heuristic" << std::endl;
+        set_evaluator(EVALUATOR_HEURISTIC);
+    }
 
     int n_game_each = (config.n_game + config.n_thread - 1) / config.n_thread;
 
@@ -0,0 +1,192 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdlib>
+#include <cassert>
+#include <cstring>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "node.hpp"
+#include "mcts.hpp"
+#include "server.hpp"
+#include "misc.hpp"
+#include "config.hpp"
+
+
+// model-vs-model match through one inference server (requests of both models are batched per model)
+// player 0 : model of --generation, player 1 : model of --opponent
+// games are played concurrently, half of them with player 0 as black
+
+#define PLAYER 0
+#define OPPONENT 1
+
+namespace {
+
+std::atomic<int> next_game(0);
+std::atomic<int> win_count[2];  // wins of player 0 as black / white
+std::atomic<int> draw_count[2];
+
+// play one game with its own search tree for each player and return result of player 0
+float play_match(bool player_black, int server_sock, std::default_random_engine& engine) {
+    const auto& config = get_config();
+
+    Board board;
+    GameNode *roots[2];
+    GameNode *nodes[2];
+    for (int player : {PLAYER, OPPONENT}) {
+        set_player(player);
+        roots[player] = new GameNode(board, Side::BLACK, 0);
+        prepare(roots[player], server_sock);
+        nodes[player] = roots[player];
+    }
+
+    Side side = Side::BLACK;
+    float result;
+    for (int move_count = 0;; move_count++) {
+        int mover = ((side == Side::BLACK) == player_black) ? PLAYER : OPPONENT;
+        int other = 1 - mover;
+
+        set_player(mover);
+        float tau = (move_count < config.e_step) ? config.tau : 0.0;
+        nodes[mover] = run_mcts(nodes[mover], tau, server_sock, engine);
+        if (nodes[mover]->terminal()) {  // tree of the other player is one ply behind if mover made the last move
+            result = nodes[mover]->board().get_result(player_black ? Side::BLACK : Side::WHITE);
+            break;
+        }
+        Action action = nodes[mover]->parent()->action();
+
+        set_player(other);
+        nodes[other] = advance(nodes[other], action, server_sock);
+        assert(nodes[other] != nullptr);
+        side = flip_side(side);
+    }
+
+    safe_delete(roots[PLAYER]);  // delete root -> whole tree
+    safe_delete(roots[OPPONENT]);
+    set_player(PLAYER);
+    return result;
+}
+
+void play_matches(int thread_id, int n_game) {
+    int server_sock = connect_to_server();  // NN server
+
+    std::random_device seed_gen;
+    std::default_random_engine engine(seed_gen());
+
+    // games [0, n_game) : player 0 as black, [n_game, 2 * n_game) : player 0 as white
+    for (int i = next_game++; i < 2 * n_game; i = next_game++) {
+        bool player_black = (i < n_game);
+        float result = play_match(player_black, server_sock, engine);
+        int k = player_black ? 0 : 1;
+        if (result > 0) {
+            win_count[k]++;
+        } else if (result == 0) {
+            draw_count[k]++;
+        }
+        if (thread_id == 0) {
+            printf("game %d (%s) result=%.0f\n", i, player_black ? "black" : "white", result);
+        }
+    }
+
+    disconnect_from_server(server_sock);
+}
+
+}  // namespace
+
+
+int main(int argc, char *argv[]) {
+    if ((argc < 3) || (argc > 3 && argv[3][0] != '-')) {
+        fprintf(stderr, "Usage: match exp_id generation [--opponent=G] [--n_game=N] [--n_simulation=N] [--n_thread=T] [--device_id=ID]\n");
+        exit(-1);
+    }
+    int exp_id = atoi(argv[1]);
+    int generation = atoi(argv[2]);
+    std::cout << "exp_id = " << exp_id << std::endl;
+    std::cout << "generation = " << generation << std::endl;
+
+    char exp_path[100];
+    get_exp_path(argv[0], exp_id, exp_path);
+    std::cout << "exp_path = " << exp_path << std::endl;
+
+    int opponent = -1;  // if -1 select best model
+    int n_game = 100;  // games for each side
+    int n_simulation = 50;
+    int n_thread = 64;
+    int device_id = 0;
+
+    int opt, longindex;
+    const struct option longopts[] = {
+        {"opponent", required_argument, NULL, 'o'},
+        {"n_game", required_argument, NULL, 'g'},
+        {"n_simulation", required_argument, NULL, 'n'},
+        {"n_thread", required_argument, NULL, 't'},
+        {"device_id", required_argument, NULL, 'd'},
+        {0, 0, 0, 0}
+    };
+    while ((opt = getopt_long(argc, argv, "o:g:n:t:d:", longopts, &longindex)) != -1) {
+        switch (opt) {
+            case 'o':
+                opponent = atoi(optarg);
+                break;
+            case 'g':
+                n_game = atoi(optarg);
+                break;
+            case 'n':
+                n_simulation = atoi(optarg);
+                break;
+            case 't':
+                n_thread = atoi(optarg);
+                break;
+            case 'd':
+                device_id = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "unknown option\n");
+                exit(-1);
+        }
+    }
+    n_thread = std::max(1, std::min(n_thread, 2 * n_game));
+    std::cout << "opponent = " << opponent << std::endl;
+    std::cout << "n_game = " << n_game << std::endl;
+    std::cout << "n_simulation = " << n_simulation << std::endl;
+    std::cout << "n_thread = " << n_thread << std::endl;
+    std::cout << "device_id = " << device_id << std::endl;
+
+    init_config(exp_path, generation, device_id);
+    add_player(exp_path, opponent);
+    // overwrite experiment configuration
+    set_config(n_thread, n_simulation, /*e_frac=*/0.0);
+
+    auto start = std::chrono::system_clock::now();
+
+    pid_t server_pid = create_server_process();
+    (void)server_pid;
+
+    std::vector<std::thread> client_threads(n_thread);
+    for (int i = 0; i < n_thread; i++) {
+        client_threads[i] = std::thread(play_matches, i, n_game);
+    }
+    for (int i = 0; i < n_thread; i++) {
+        client_threads[i].join();
+    }
+
+    auto end = std::chrono::system_clock::now();
+    float elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() * 1e-3;
+
+    // same format as mediator.py (win rate of player 0 on each side)
+    const char *side_names[2] = {"black", "white"};
+    for (int k = 0; k < 2; k++) {
+        printf("%s win rate = %.2f %%  (%d / %d)\n", side_names[k], 100.0 * win_count[k] / n_game, win_count[k].load(), n_game);
+    }
+    int n_draw = draw_count[0] + draw_count[1];
+    printf("draw rate = %.2f %%  (%d / %d)\n", 100.0 * n_draw / (2 * n_game), n_draw, 2 * n_game);
+    printf("played %d games in %.2f sec\n", 2 * n_game, elapsed);
+
+    return 0;
+}
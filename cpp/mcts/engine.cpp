@@ -0,0 +1,300 @@
+// line-based engine protocol (one command per line)
+// new-game                         : start from the initial position
+// set-position [action ...]        : actions from the initial position (e.g. "set-position f5 d6 pass")
+//                                    the search tree is reused if the current actions are a prefix
+// go [nodes N] [movetime MSEC] [info MSEC] [multipv K]
+//                                  : search current position and reply "bestmove <action>"
+//                                    with info, snapshots are sent every MSEC while searching
+// analyze [info MSEC] [multipv K]  : search current position until stopped, sending snapshots
+// stop                             : stop searching (reply of go is sent immediately)
+// ponder                           : search current position until stopped or position changes
+// ponder on / ponder off           : search the expected position after each bestmove
+// isready                          : reply "readyok"
+// quit                             : exit
+// errors are reported as "error <message>"
+// snapshots are sent as "info <json>", e.g.
+// info {"time_msec":100,"nodes":812,"nps":8120.0,"evals_per_sec":7900.0,
+//       "lines":[{"action":"f5","N":500,"Q":0.12,"prior":0.3,"proof":"unknown","pv":["f5","d6"]},...]}
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#include "engine.hpp"
+#include "mcts.hpp"
+#include "node.hpp"
+#include "server.hpp"
+#include "misc.hpp"
+#include "config.hpp"
+
+
+namespace {
+
+// output is written by a dedicated thread so that search threads never block on stdout
+std::mutex output_mutex;
+std::condition_variable output_cv;
+std::deque<std::string> output_queue;
+bool output_closed = false;
+std::thread output_thread;
+
+GameNode *root = nullptr;  // initial position
+GameNode *current_node = nullptr;
+std::vector<Action> actions;  // actions from root to current_node
+
+std::thread search_thread;
+std::atomic<bool> stop_flag(false);
+std::atomic<bool> auto_ponder(false);
+
+typedef struct {
+    int info_msec;  // interval of snapshots (negative: no snapshot)
+    int multipv;  // number of moves in snapshot
+} info_option_t;
+
+void send(const std::string& message) {
+    {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        output_queue.push_back(message);
+    }
+    output_cv.notify_one();
+}
+
+void write_output() {
+    std::unique_lock<std::mutex> lock(output_mutex);
+    while (true) {
+        output_cv.wait(lock, [] { return !output_queue.empty() || output_closed; });
+        if (output_queue.empty()) {  // closed
+            break;
+        }
+        std::string message = std::move(output_queue.front());
+        output_queue.pop_front();
+        lock.unlock();
+        std::cout << message << std::endl;
+        lock.lock();
+    }
+}
+
+void close_output() {
+    {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        output_closed = true;
+    }
+    output_cv.notify_one();
+    output_thread.join();
+}
+
+std::string to_string(Action action) {
+    std::ostringstream oss;
+    oss << action;
+    return oss.str();
+}
+
+std::string format_info(const GameNode *node, int multipv, int elapsed_msec, int sim_count, long n_evaluation) {
+    float elapsed_sec = std::max(elapsed_msec, 1) * 1e-3;
+    std::ostringstream oss;
+    oss << "info {\"time_msec\":" << elapsed_msec
+        << ",\"nodes\":" << sim_count
+        << ",\"nps\":" << sim_count / elapsed_sec
+        << ",\"evals_per_sec\":" << n_evaluation / elapsed_sec
+        << ",\"lines\":[";
+    auto lines = get_multi_pv(node, multipv);
+    for (unsigned int i = 0; i < lines.size(); i++) {
+        const auto& line = lines[i];
+        oss << (i > 0 ? "," : "")
+            << "{\"action\":\"" << line.action
+            << "\",\"N\":" << line.N
+            << ",\"Q\":" << line.Q
+            << ",\"prior\":" << line.prior
+            << ",\"proof\":\"" << line.proof
+            << "\",\"pv\":[";
+        for (unsigned int j = 0; j < line.pv.size(); j++) {
+            oss << (j > 0 ? "," : "") << "\"" << line.pv[j] << "\"";
+        }
+        oss << "]}";
+    }
+    oss << "]}";
+    return oss.str();
+}
+
+// search until stopped, node solved or limit reached (negative limit: unlimited)
+void search(GameNode *node, int n_simulation, int time_msec, int server_sock, info_option_t info = {-1, 1}) {
+    auto start = std::chrono::steady_clock::now();
+    long start_evaluation = get_n_evaluation();
+    int next_info_msec = info.info_msec;
+    int sim_count = 0;
+    int elapsed = 0;
+    for (; n_simulation < 0 || sim_count < n_simulation; sim_count++) {
+        if (sim_count > 0 && (stop_flag || node->solved())) {  // at least one simulation for bestmove
+            break;
+        }
+        elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        if (time_msec >= 0 && sim_count > 0 && elapsed >= time_msec) {
+            break;
+        }
+        if (info.info_msec > 0 && elapsed >= next_info_msec) {
+            send(format_info(node, info.multipv, elapsed, sim_count, get_n_evaluation() - start_evaluation));
+            next_info_msec = elapsed + info.info_msec;
+        }
+        simulate(node, server_sock);
+    }
+    if (info.info_msec > 0) {  // final snapshot
+        elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+        send(format_info(node, info.multipv, elapsed, sim_count, get_n_evaluation() - start_evaluation));
+    }
+}
+
+void stop_search() {
+    stop_flag = true;
+    if (search_thread.joinable()) {
+        search_thread.join();
+    }
+    stop_flag = false;
+}
+
+void new_game(int server_sock) {
+    stop_search();
+    safe_delete(root);  // delete root -> whole tree
+    root = new GameNode(Board(), Side::BLACK, 0);
+    prepare(root, server_sock);
+    current_node = root;
+    actions.clear();
+}
+
+void set_position(const std::vector<Action>& new_actions, int server_sock) {
+    stop_search();
+    bool reuse = (new_actions.size() >= actions.size()) && std::equal(actions.begin(), actions.end(), new_actions.begin());
+    if (!reuse) {
+        new_game(server_sock);
+    }
+    for (unsigned int i = actions.size(); i < new_actions.size(); i++) {
+        GameNode *next = advance(current_node, new_actions[i], server_sock);
+        if (next == nullptr) {
+            send("error illegal action " + to_string(new_actions[i]));
+            return;
+        }
+        current_node = next;
+        actions.push_back(new_actions[i]);
+    }
+}
+
+void go(int n_simulation, int time_msec, info_option_t info, int server_sock) {
+    stop_search();
+    if (current_node->terminal()) {
+        send("error game over");
+        return;
+    }
+    GameNode *node = current_node;
+    search_thread = std::thread([node, n_simulation, time_msec, info, server_sock]() {
+        search(node, n_simulation, time_msec, server_sock, info);
+        std::default_random_engine engine;
+        GameNode *next = node->next_node(/*tau=*/0.0, engine);
+        send("bestmove " + to_string(node->action()));
+
+        if (auto_ponder && !stop_flag && !next->terminal()) {  // think on opponent's time
+            prepare(next, server_sock);
+            search(next, -1, -1, server_sock);
+        }
+    });
+}
+
+void ponder(info_option_t info, int server_sock) {
+    stop_search();
+    if (current_node->terminal()) {
+        return;
+    }
+    GameNode *node = current_node;
+    search_thread = std::thread([node, info, server_sock]() {
+        search(node, -1, -1, server_sock, info);
+    });
+}
+
+}  // namespace
+
+
+void run_engine(int server_sock) {
+    const auto& config = get_config();
+
+    output_thread = std::thread(write_output);
+    new_game(server_sock);
+
+    std::string line;
+    while (std::getline(std::cin, line)) {
+        std::istringstream iss(line);
+        std::string command;
+        if (!(iss >> command)) {
+            continue;
+        }
+
+        if (command == "new-game") {
+            new_game(server_sock);
+        } else if (command == "set-position") {
+            std::vector<Action> new_actions;
+            std::string input;
+            bool valid = true;
+            while (iss >> input) {
+                Action action = parse_action(input);
+                if (action == SpetialAction::INVALID || action == SpetialAction::BACK) {
+                    send("error invalid action " + input);
+                    valid = false;
+                    break;
+                }
+                new_actions.push_back(action);
+            }
+            if (valid) {
+                set_position(new_actions, server_sock);
+            }
+        } else if (command == "go" || command == "analyze") {
+            int n_simulation = -1;
+            int time_msec = -1;
+            info_option_t info = {(command == "analyze") ? 500 : -1, 3};
+            std::string key;
+            int value;
+            while (iss >> key >> value) {
+                if (key == "nodes") {
+                    n_simulation = value;
+                } else if (key == "movetime") {
+                    time_msec = value;
+                } else if (key == "info") {
+                    info.info_msec = value;
+                } else if (key == "multipv") {
+                    info.multipv = value;
+                }
+            }
+            if (command == "analyze") {
+                ponder(info, server_sock);
+                continue;
+            }
+            if (n_simulation < 0 && time_msec < 0) {
+                n_simulation = config.n_simulation;
+            }
+            go(n_simulation, time_msec, info, server_sock);
+        } else if (command == "stop") {
+            stop_search();
+        } else if (command == "ponder") {
+            std::string arg;
+            if (iss >> arg) {
+                auto_ponder = (arg == "on");
+            } else {
+                ponder({-1, 1}, server_sock);
+            }
+        } else if (command == "isready") {
+            send("readyok");
+        } else if (command == "quit") {
+            break;
+        } else {
+            send("error unknown command " + command);
+        }
+    }
+
+    stop_search();
+    safe_delete(root);
+    close_output();
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+
+void run_engine(int server_sock);
@@ -2,6 +2,8 @@
 #include <vector>
 #include <cassert>
 #include <random>
+#include <numeric>
+#include <algorithm>
 
 #include "mcts.hpp"
 #include "board.hpp"
@@ -41,21 +43,11 @@ GameNode *run_mcts(GameNode *current_node, float tau, int server_sock, std::defa
     current_node->add_exploration_noise(engine);
 
     for (int sim_count = 0; sim_count < config.n_simulation; sim_count++) {
-        GameNode* node = current_node;
-        // printf("sim_count=%d\n", sim_count);
-        while (node->expanded()) {  // terminal => not expanded
-            // p("forward");
-            // p(node);
-            node = node->select_child();
-        }
-        // before expand => terminal=false even if terminal in fact
-        if (!node->terminal()) {
-            node->expand(server_sock);
+        if (current_node->solved()) {  // no need to search any more
+            break;
         }
-        // p("leaf");
-        // p(node);
-        node->backpropagete(node->value(), current_node);
-        // p();
+        // printf("sim_count=%d\n", sim_count);
+        simulate(current_node, server_sock);
     }
 
     GameNode* next_node = current_node->next_node(tau, engine);
@@ -75,3 +67,110 @@ GameNode *run_mcts(GameNode *current_node, float tau, int server_sock, std::defa
 
     return next_node;
 }
+
+// one simulation: select leaf, expand it and backpropagate its value
+void simulate(GameNode *current_node, int server_sock) {
+    GameNode* node = current_node;
+    int depth = 0;
+    while (node->expanded() && !node->solved()) {  // terminal => not expanded
+        // p("forward");
+        // p(node);
+        node = node->select_child();
+        depth += 1;
+    }
+    // before expand => terminal=false even if terminal in fact
+    if (!node->terminal() && !node->solved()) {
+        node->expand(server_sock, depth);
+    }
+    // p("leaf");
+    // p(node);
+    float value = node->solved() ? node->proven_value() : node->value();
+    node->backpropagete(value, current_node);
+    // p();
+}
+
+// top k moves by visit count with their principal variations
+std::vector<pv_t> get_multi_pv(const GameNode *node, int k) {
+    std::vector<pv_t> lines;
+    if (!node->expanded()) {
+        return lines;
+    }
+
+    const auto& children = node->children();
+    std::vector<int> idxs(children.size());
+    std::iota(idxs.begin(), idxs.end(), 0);
+    k = std::min(k, (int)idxs.size());
+    std::partial_sort(idxs.begin(), idxs.begin() + k, idxs.end(),
+        [&children](int idx1, int idx2) {
+            return children[idx1]->N() > children[idx2]->N();
+        });
+
+    for (int i = 0; i < k; i++) {
+        const GameNode *child = children[idxs[i]];
+        pv_t line;
+        line.action = node->pass() ? SpetialAction::PASS : node->legal_actions()[idxs[i]];
+        line.N = child->N();
+        line.Q = -child->Q();  // flip opponent's value
+        line.prior = child->prior();
+        line.proof = (child->proof() == Proof::WIN) ? Proof::LOSS : (child->proof() == Proof::LOSS) ? Proof::WIN : child->proof();
+        line.pv.push_back(line.action);
+
+        // follow the most visited child
+        const GameNode *current = child;
+        while (current->expanded()) {
+            const auto& grandchildren = current->children();
+            auto it = std::max_element(grandchildren.begin(), grandchildren.end(),
+                [](const GameNode *node1, const GameNode *node2) {
+                    return node1->N() < node2->N();
+                });
+            if ((*it)->N() == 0) {
+                break;
+            }
+            int idx = it - grandchildren.begin();
+            line.pv.push_back(current->pass() ? (Action)SpetialAction::PASS : current->legal_actions()[idx]);
+            current = *it;
+        }
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+// expand node and count its first visit so that it can be searched
+void prepare(GameNode *node, int server_sock) {
+    if (!node->expanded() && !node->terminal()) {
+        node->expand(server_sock);
+        node->backpropagete(node->value(), node);
+    }
+}
+
+GameNode *find_child(GameNode *node, Action action) {
+    if (!node->expanded()) {
+        return nullptr;
+    }
+    if (action == SpetialAction::PASS) {
+        return node->pass() ? node->children()[0] : nullptr;
+    }
+    const auto& legal_actions = node->legal_actions();
+    for (unsigned int i = 0; i < legal_actions.size(); i++) {
+        if (legal_actions[i] == action) {
+            return node->children()[i];
+        }
+    }
+    return nullptr;
+}
+
+// move to child and delete its siblings (the subtree of child is kept)
+GameNode *advance(GameNode *node, Action action, int server_sock) {
+    prepare(node, server_sock);
+    GameNode *next = find_child(node, action);
+    if (next == nullptr) {
+        return nullptr;
+    }
+    for (auto& child : node->children_()) {
+        if (child != next) {
+            safe_delete(child);
+        }
+    }
+    prepare(next, server_sock);
+    return next;
+}
@@ -8,3 +8,18 @@
 
 void play_game(std::vector<GameNode*>& history, int server_sock, std::default_random_engine& engine);
 GameNode *run_mcts(GameNode *current_node, float tau, int server_sock, std::default_random_engine& engine);
+void simulate(GameNode *current_node, int server_sock);
+void prepare(GameNode *node, int server_sock);
+GameNode *find_child(GameNode *node, Action action);
+GameNode *advance(GameNode *node, Action action, int server_sock);
+
+typedef struct {
+    Action action;
+    int N;
+    float Q;  // from the viewpoint of side to move at root
+    float prior;
+    Proof proof;  // from the viewpoint of side to move at root
+    std::vector<Action> pv;  // principal variation starting with action
+} pv_t;
+
+std::vector<pv_t> get_multi_pv(const GameNode *node, int k);
@@ -23,6 +23,7 @@ GameNode::GameNode(Board board, Side side, float prior, GameNode* parent) {
     m_value = 0;
     m_pass = false;
     m_terminal = false;  // m_terminal must be initialized as false
+    m_proof = Proof::UNKNOWN;
     m_action = SpetialAction::INVALID;
     m_legal_flags.resize(64, false);
     m_posteriors.resize(64, 0);
@@ -98,8 +99,21 @@ Action GameNode::action() const {
     return m_action;
 }
 
+Proof GameNode::proof() const {
+    return m_proof;
+}
+
+bool GameNode::solved() const {
+    return m_proof != Proof::UNKNOWN;
+}
+
+float GameNode::proven_value() const {
+    assert(solved());
+    return (m_proof == Proof::WIN) - (m_proof == Proof::LOSS);
+}
 
-void GameNode::expand(int server_sock) {
+
+void GameNode::expand(int server_sock, int depth) {
     // get all legal actions and check pass
     m_legal_actions = m_board.get_all_legal_actions(m_side);
     for (auto action : m_legal_actions) {
@@ -111,13 +125,35 @@ void GameNode::expand(int server_sock) {
     m_terminal = (m_parent && (m_pass && m_parent->pass())) || m_board.is_full();
     if (m_terminal) {
         m_value = m_board.get_result(m_side);  // substitute result for NN output
+        m_proof = (m_value > 0) ? Proof::WIN : (m_value < 0) ? Proof::LOSS : Proof::DRAW;
         return;
     }
+    m_proof = Proof::UNKNOWN;  // children are re-created
 
     std::vector<float> priors(64);  // softmax-ed priors;
-    request(server_sock, m_board, m_side, m_legal_flags, priors, m_value);
+    int visits = m_parent ? m_parent->N() : 0;
+    request(server_sock, m_board, m_side, m_legal_flags, priors, m_value, depth, visits);
 
     add_children(priors);
+
+    // let the server evaluate the most promising children with spare batch capacity
+    unsigned int capacity = get_speculative_capacity();
+    if (capacity > 0) {
+        std::vector<GameNode*> candidates(m_children);
+        capacity = std::min(capacity, (unsigned int)candidates.size());
+        std::partial_sort(candidates.begin(), candidates.begin() + capacity, candidates.end(),
+            [](const GameNode* node1, const GameNode* node2) {
+                return node1->prior() > node2->prior();
+            });
+        std::vector<std::tuple<Board, Side>> positions;
+        for (unsigned int k = 0; k < capacity; k++) {
+            if (!candidates[k]->board().is_full()) {
+                positions.emplace_back(candidates[k]->board(), candidates[k]->side());
+            }
+        }
+        // a child is expanded at the earliest after this expansion is backpropagated through this node
+        set_speculative(positions, depth + 1, m_N + 1);
+    }
 }
 
 void GameNode::add_children(const std::vector<float>& priors) {
@@ -136,12 +172,39 @@ void GameNode::add_children(const std::vector<float>& priors) {
     }
 }
 
+// minimax rule: children's proofs are from the opponent's viewpoint
+void GameNode::update_proof() {
+    bool all_solved = true;
+    bool has_draw = false;
+    for (const auto& child : m_children) {
+        switch (child->proof()) {
+        case Proof::LOSS:  // opponent loses after this move
+            m_proof = Proof::WIN;
+            return;
+        case Proof::DRAW:
+            has_draw = true;
+            break;
+        case Proof::WIN:
+            break;
+        case Proof::UNKNOWN:
+            all_solved = false;
+            break;
+        }
+    }
+    if (all_solved) {
+        m_proof = has_draw ? Proof::DRAW : Proof::LOSS;
+    }
+}
+
 void GameNode::backpropagete(float value, GameNode* stop_node) {
     m_Q = (m_Q * m_N + value) / (m_N + 1);
     m_N += 1;
     // p("backpropagete");
     // p(this);
     if (this != stop_node) {
+        if (solved() && !m_parent->solved()) {
+            m_parent->update_proof();
+        }
         m_parent->backpropagete(-value, stop_node);  // flip value for opponent
     }
 }
@@ -154,6 +217,11 @@ GameNode* GameNode::select_child() const {
     // printf("selecting...\n");
     // int i = 0;
     for (const auto& child : m_children) {
+        if (child->proof() == Proof::LOSS) {  // proven winning move
+            return child;
+        } else if (child->proof() == Proof::WIN) {  // proven losing move
+            continue;
+        }
         float value_score = -child->Q();  // flip opponent's value
         // TODO: log term necessary?
         float prior_score = child->prior() * std::sqrt(m_N) / (child->N() + 1);
@@ -165,7 +233,9 @@ GameNode* GameNode::select_child() const {
             selected = child;
         }
     }
-    assert(selected != nullptr);
+    if (selected == nullptr) {  // every move loses
+        selected = m_children[0];
+    }
     // p();
     return selected;
 }
@@ -178,6 +248,15 @@ GameNode* GameNode::next_node(float tau, std::default_random_engine& engine) {
         return m_children[0];
     }
 
+    // play a proven winning move if the solver found one
+    for (unsigned int i = 0; i < m_children.size(); i++) {
+        if (m_children[i]->proof() == Proof::LOSS) {
+            m_action = m_legal_actions[i];
+            m_posteriors[m_action] = 1.0;
+            return m_children[i];
+        }
+    }
+
     bool stochastic = (tau > 0.01);
     float tau_inv = stochastic ? 1.0 / tau : 1.0;
 
@@ -194,6 +273,26 @@ GameNode* GameNode::next_node(float tau, std::default_random_engine& engine) {
         }
     }
 
+    // avoid proven losing moves as long as another move has been visited
+    float losing_sum = 0;
+    for (unsigned int i = 0; i < m_children.size(); i++) {
+        if (m_children[i]->proof() == Proof::WIN) {
+            losing_sum += ratios[i];
+        }
+    }
+    if (ratio_sum - losing_sum >= 1.0 && losing_sum > 0) {
+        ratio_max = 0;
+        for (unsigned int i = 0; i < m_children.size(); i++) {
+            if (m_children[i]->proof() == Proof::WIN) {
+                ratios[i] = 0;
+            } else if (ratios[i] > ratio_max) {
+                ratio_max = ratios[i];
+                ratio_max_idx = i;
+            }
+        }
+        ratio_sum -= losing_sum;
+    }
+
     assert(ratio_sum >= 1.0);
 
     unsigned int selected = 64;  // TODO: delete initialization
@@ -248,6 +347,24 @@ void GameNode::set_prior(const float prior) {
     m_prior = prior;
 }
 
+std::ostream& operator<<(std::ostream& os, Proof proof) {
+    switch (proof) {
+    case Proof::UNKNOWN:
+        os << "unknown";
+        break;
+    case Proof::WIN:
+        os << "win";
+        break;
+    case Proof::LOSS:
+        os << "loss";
+        break;
+    case Proof::DRAW:
+        os << "draw";
+        break;
+    }
+    return os;
+}
+
 std::ostream& operator<<(std::ostream& os, const GameNode& node) {
     os << node.board();
     os << node.side() << std::endl;
@@ -275,7 +392,7 @@ std::ostream& operator<<(std::ostream& os, const GameNode& node) {
     } else {
         os << "not expanded  ";
     }
-    os << "\nN=" << node.N() << " Q=" << node.Q() << " v=" << node.value() << " t=" << node.terminal() << std::endl;
+    os << "\nN=" << node.N() << " Q=" << node.Q() << " v=" << node.value() << " t=" << node.terminal() << " proof=" << node.proof() << std::endl;
 
     int count_b = node.board().count(CellState::BLACK);
     int count_w = node.board().count(CellState::WHITE);
@@ -10,6 +10,18 @@
 #include "board.hpp"
 
 
+// game-theoretic value proven by the solver (from the viewpoint of the side to move)
+enum class Proof : uint8_t
+{
+    UNKNOWN,
+    WIN,
+    LOSS,
+    DRAW
+};
+
+std::ostream& operator<<(std::ostream& os, Proof proof);
+
+
 class GameNode
 {
 public:
@@ -34,10 +46,14 @@ public:
     const std::vector<bool>& legal_flags() const;
     const std::vector<float>& posteriors() const;
     bool expanded() const;
+    Proof proof() const;
+    bool solved() const;
+    float proven_value() const;
 
-    void expand(int server_sock);
+    void expand(int server_sock, int depth = 0);
     void add_children(const std::vector<float>& priors);
     GameNode* select_child() const;
+    void update_proof();
     void backpropagete(float value, GameNode* stop_node);
     GameNode* next_node(float tau, std::default_random_engine& engine);
     void add_exploration_noise(std::default_random_engine& engine);
@@ -54,6 +70,7 @@ private:
     float m_value;
     bool m_pass;
     bool m_terminal;
+    Proof m_proof;
     Action m_action;
     std::vector<Action> m_legal_actions;
     std::vector<bool> m_legal_flags;
@@ -0,0 +1,134 @@
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <cassert>
+
+#include "batch.hpp"
+#include "model.hpp"
+#include "config.hpp"
+
+
+namespace {
+// rows of the batch being staged in calling thread
+// inputs are read in place (shared-memory slot or buffer of the client) when staged
+thread_local std::vector<std::vector<const input_t*>> recv_data;  // batch of each model
+
+// rows to run for n_main main inputs (smallest power of two if bucketed, at most n_thread)
+int bucket_size(int n_main) {
+    const auto& config = get_config();
+
+    if (!config.batch_bucket || n_main == 0) {
+        return n_main;
+    }
+    int size = 1;
+    while (size < n_main) {
+        size *= 2;
+    }
+    return std::max(std::min(size, config.n_thread), n_main);
+}
+}
+
+
+void stage_batch(const batch_request_t *requests, int n_request, int buffer_id, batch_plan_t& plan) {
+    const auto& config = get_config();
+
+    int batch_size = config.n_thread;  // max rows of a batch
+    int n_model = get_n_model();
+    assert(n_request > 0 && n_request <= batch_size);
+    if ((int)recv_data.size() != n_model) {
+        recv_data.assign(n_model, std::vector<const input_t*>(batch_size));
+    }
+    plan.buffer_id = buffer_id;
+    plan.n_row.assign(n_model, 0);
+    plan.main_slots.resize(n_request);
+    plan.spec_slots.assign(n_request, {});
+
+    // main inputs are packed from row 0 in the batch of the selected model
+    std::vector<int>& n_row = plan.n_row;
+    for (int k = 0; k < n_request; k++) {
+        int model_id = select_model(requests[k].inputs[0]);
+        int row = n_row[model_id]++;
+        recv_data[model_id][row] = &requests[k].inputs[0];
+        plan.main_slots[k] = std::make_pair(model_id, row);
+    }
+
+    // fill padding rows of active batches with speculative inputs (round robin)
+    std::vector<int> n_padded(n_model);
+    for (int model_id = 0; model_id < n_model; model_id++) {
+        n_padded[model_id] = bucket_size(n_row[model_id]);
+    }
+    for (int s = 0; s < MAX_SPECULATIVE; s++) {
+        for (int k = 0; k < n_request; k++) {
+            if (s >= requests[k].n_speculative || s > (int)plan.spec_slots[k].size()) {
+                continue;  // outputs are returned in order, so stop at the first dropped input
+            }
+            const input_t& input = requests[k].inputs[1 + s];
+            int model_id = select_model(input);
+            if (n_row[model_id] < n_padded[model_id]) {
+                int row = n_row[model_id]++;
+                recv_data[model_id][row] = &input;
+                plan.spec_slots[k].emplace_back(model_id, row);
+            }
+        }
+    }
+    plan.n_free = 0;
+    for (int model_id = 0; model_id < n_model; model_id++) {
+        plan.n_free += n_padded[model_id] - n_row[model_id];
+        if (n_row[model_id] > 0) {
+            stage(model_id, buffer_id, recv_data[model_id].data(), n_row[model_id]);
+        }
+        n_row[model_id] = n_padded[model_id];  // rows not used by speculative inputs are run with stale data of the buffer
+    }
+}
+
+float forward_batch(batch_plan_t& plan) {
+    const auto& config = get_config();
+
+    int n_model = plan.n_row.size();
+    if ((int)plan.send_data.size() != n_model) {
+        plan.send_data.assign(n_model, std::vector<output_t>(config.n_thread));
+    }
+    plan.generations.assign(n_model, 0);
+    auto start = std::chrono::steady_clock::now();
+    for (int model_id = 0; model_id < n_model; model_id++) {
+        if (plan.n_row[model_id] > 0) {
+            plan.generations[model_id] = forward(model_id, plan.buffer_id, plan.send_data[model_id].data(), plan.n_row[model_id]);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+void finish_batch(batch_request_t *requests, int n_request, const batch_plan_t& plan) {
+    for (int k = 0; k < n_request; k++) {
+        response_header_t& header = requests[k].header;
+        header.n_evaluated = plan.spec_slots[k].size();
+        header.n_free = plan.n_free / n_request;
+        const auto& main_slot = plan.main_slots[k];
+        header.model_generation = plan.generations[main_slot.first];
+        requests[k].outputs[0] = plan.send_data[main_slot.first][main_slot.second];
+        for (int s = 0; s < header.n_evaluated; s++) {
+            const auto& slot = plan.spec_slots[k][s];
+            requests[k].outputs[1 + s] = plan.send_data[slot.first][slot.second];
+        }
+    }
+}
+
+float evaluate_batch(batch_request_t *requests, int n_request) {
+    thread_local batch_plan_t plan;
+    stage_batch(requests, n_request, /*buffer_id=*/0, plan);
+    float elapsed = forward_batch(plan);
+    finish_batch(requests, n_request, plan);
+    return elapsed;
+}
+
+// waiting pays off while the batch is far from full and a forward pass is expensive compared to the wait,
+// but a request must not stay in the server longer than max_latency_usec including the forward pass
+long batch_wait_usec(int n_recv, int n_expected, float forward_usec) {
+    const auto& config = get_config();
+
+    float fill = (float)n_recv / std::max(n_expected, 1);
+    float wait = forward_usec * (1.0 - fill);
+    wait = std::min(wait, config.max_latency_usec - forward_usec);
+    return std::max((long)wait, 0L);
+}
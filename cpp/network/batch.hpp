@@ -0,0 +1,36 @@
+#pragma once
+
+#include <vector>
+#include <utility>
+
+#include "server.hpp"
+
+
+typedef struct {
+    const input_t *inputs;  // main input followed by n_speculative speculative inputs
+    int n_speculative;
+    response_header_t header;  // set by finish_batch()
+    output_t *outputs;  // room for 1 + MAX_SPECULATIVE outputs
+} batch_request_t;
+
+// placement of a batch in the rows of each model
+typedef struct {
+    int buffer_id;  // staging buffer holding the inputs
+    std::vector<int> n_row;  // rows to run for each model (0: model not used)
+    std::vector<std::pair<int, int>> main_slots;  // (model, row) of main inputs
+    std::vector<std::vector<std::pair<int, int>>> spec_slots;  // (model, row) of speculative inputs
+    int n_free;  // padding rows not used by speculative inputs
+    std::vector<int> generations;  // generation of weights of each model
+    std::vector<std::vector<output_t>> send_data;  // outputs of each model
+} batch_plan_t;
+
+// a batch (at most n_thread requests) goes through three steps, which may run in different threads:
+// stage_batch() places inputs in rows and writes them into staging buffer, forward_batch() runs models
+// and returns elapsed time (usec), finish_batch() copies outputs to requests
+void stage_batch(const batch_request_t *requests, int n_request, int buffer_id, batch_plan_t& plan);
+float forward_batch(batch_plan_t& plan);
+void finish_batch(batch_request_t *requests, int n_request, const batch_plan_t& plan);
+// all steps in calling thread with staging buffer 0, return elapsed time of forward_batch()
+float evaluate_batch(batch_request_t *requests, int n_request);
+// how long a batch is kept open after its first request
+long batch_wait_usec(int n_recv, int n_expected, float forward_usec);
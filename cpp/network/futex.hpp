@@ -0,0 +1,21 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+
+// shared: word may be in memory shared with another process
+inline void futex_wait(std::atomic<uint32_t>& word, uint32_t value, bool shared, long timeout_usec = -1) {
+    struct timespec timeout;
+    timeout.tv_sec = timeout_usec / 1000000;
+    timeout.tv_nsec = (timeout_usec % 1000000) * 1000;
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), shared ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, value, (timeout_usec < 0) ? NULL : &timeout, NULL, 0);
+}
+
+inline void futex_wake(std::atomic<uint32_t>& word, bool shared) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), shared ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
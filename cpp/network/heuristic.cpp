@@ -0,0 +1,79 @@
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "heuristic.hpp"
+#include "board.hpp"
+#include "misc.hpp"
+
+
+// handcrafted evaluator (square weights and mobility) used instead of NN for bootstrapping
+
+namespace {
+
+const int SQUARE_WEIGHTS[64] = {
+    100, -20,  10,   5,   5,  10, -20, 100,
+    -20, -50,  -2,  -2,  -2,  -2, -50, -20,
+     10,  -2,   1,   1,   1,   1,  -2,  10,
+      5,  -2,   1,   0,   0,   1,  -2,   5,
+      5,  -2,   1,   0,   0,   1,  -2,   5,
+     10,  -2,   1,   1,   1,   1,  -2,  10,
+    -20, -50,  -2,  -2,  -2,  -2, -50, -20,
+    100, -20,  10,   5,   5,  10, -20, 100,
+};
+const float MOBILITY_WEIGHT = 5.0;  // per legal move
+const float DISK_WEIGHT = 3.0;  // per disk, only near the end
+const int ENDGAME_DISK_NUM = 50;
+const float PRIOR_TEMPERATURE = 20.0;
+const float VALUE_SCALE = 100.0;
+
+int weight_sum(BitBoard board) {
+    int sum = 0;
+    while (board) {
+        sum += SQUARE_WEIGHTS[__builtin_ctzll(board)];
+        board &= board - 1;
+    }
+    return sum;
+}
+
+}  // namespace
+
+
+void evaluate_heuristic(const Board& board, const Side side, const std::vector<bool>& legal_flags, std::vector<float>& priors, float& value) {
+    BitBoard player_board = board.get_player_board(side);
+    BitBoard opponent_board = board.get_opponent_board(side);
+    int player_mobility = bit_count(board.make_legal_board(side));
+    int opponent_mobility = bit_count(board.make_legal_board(flip_side(side)));
+
+    // value : positional + mobility (+ disk count near the end)
+    float score = weight_sum(player_board) - weight_sum(opponent_board)
+        + MOBILITY_WEIGHT * (player_mobility - opponent_mobility);
+    if (board.get_disk_num() >= ENDGAME_DISK_NUM) {
+        score += DISK_WEIGHT * (bit_count(player_board) - bit_count(opponent_board));
+    }
+    value = std::tanh(score / VALUE_SCALE);
+
+    // priors : softmax of square weight minus opponent's mobility after the move
+    std::fill(priors.begin(), priors.end(), 0);
+    float max_score = -1e9;
+    for (Action action = 0; action < 64; action++) {
+        if (!legal_flags[action]) {
+            continue;
+        }
+        Board next_board(board);
+        next_board.place_disk(action, side);
+        int next_mobility = bit_count(next_board.make_legal_board(flip_side(side)));
+        priors[action] = SQUARE_WEIGHTS[action] - MOBILITY_WEIGHT * next_mobility;
+        max_score = std::max(max_score, priors[action]);
+    }
+    float sum = 0;
+    for (Action action = 0; action < 64; action++) {
+        if (legal_flags[action]) {
+            priors[action] = std::exp((priors[action] - max_score) / PRIOR_TEMPERATURE);
+            sum += priors[action];
+        }
+    }
+    for (Action action = 0; action < 64 && sum > 0; action++) {
+        priors[action] /= sum;
+    }
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <vector>
+
+#include "board.hpp"
+
+
+void evaluate_heuristic(const Board& board, const Side side, const std::vector<bool>& legal_flags, std::vector<float>& priors, float& value);
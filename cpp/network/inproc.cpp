@@ -0,0 +1,135 @@
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include "inproc.hpp"
+#include "batch.hpp"
+#include "model.hpp"
+#include "futex.hpp"
+#include "config.hpp"
+
+
+// in-process inference: client threads push requests into a lock-free queue
+// and a dedicated inference thread evaluates them in batches (no server process, no IPC)
+
+namespace {
+
+std::atomic<inproc_request_t*> queue_head(nullptr);  // stack of requests (multiple producers, taken at once by consumer)
+std::atomic<uint32_t> queue_seq(0);  // futex word to wake up inference thread
+std::atomic<uint32_t> server_waiting(0);
+std::atomic<int> n_client(0);
+
+// move queued requests to pending in arrival order
+void drain(std::deque<inproc_request_t*>& pending) {
+    inproc_request_t *head = queue_head.exchange(nullptr);
+    auto end = pending.end();
+    for (; head; head = head->next) {
+        end = pending.insert(end, head);  // stack is newest first
+    }
+}
+
+// clients check server_waiting after pushing, so a request pushed after the check below wakes us up
+void sleep_until_request(long timeout_usec) {
+    uint32_t seq = queue_seq.load();
+    server_waiting.store(1);
+    if (queue_head.load() == nullptr) {
+        futex_wait(queue_seq, seq, /*shared=*/false, timeout_usec);
+    }
+    server_waiting.store(0);
+}
+
+void complete(inproc_request_t& request) {
+    if (request.state.exchange(INPROC_DONE) == INPROC_WAITING) {
+        futex_wake(request.state, /*shared=*/false);
+    }
+}
+
+void run_inference() {
+    const auto& config = get_config();
+
+    int batch_size = config.n_thread;  // rows of a batch
+    std::deque<inproc_request_t*> pending;
+    std::vector<inproc_request_t*> batch;
+    std::vector<batch_request_t> requests(batch_size);
+    float forward_usec = 0.0;  // moving average of the time of inference per batch
+
+    while (true) {
+        batch.clear();
+        auto first_arrival = std::chrono::steady_clock::now();
+
+        // take requests until the batch is full, every client is waiting or the wait budget is spent
+        while (true) {
+            drain(pending);
+            while (!pending.empty() && (int)batch.size() < batch_size) {
+                if (batch.empty()) {
+                    first_arrival = std::chrono::steady_clock::now();
+                }
+                batch.push_back(pending.front());
+                pending.pop_front();
+            }
+            if (batch.empty()) {
+                sleep_until_request(-1);
+                continue;
+            }
+            int n_expected = std::min(batch_size, n_client.load());
+            long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - first_arrival).count();
+            long remaining = batch_wait_usec(batch.size(), n_expected, forward_usec) - elapsed;
+            if ((int)batch.size() >= n_expected || remaining <= 0) {
+                break;
+            }
+            sleep_until_request(remaining);
+        }
+
+        int n_request = batch.size();
+        for (int k = 0; k < n_request; k++) {
+            requests[k].inputs = batch[k]->inputs;
+            requests[k].n_speculative = batch[k]->n_speculative;
+            requests[k].outputs = batch[k]->outputs;
+        }
+        float elapsed = evaluate_batch(requests.data(), n_request);
+        forward_usec = (forward_usec == 0.0) ? elapsed : forward_usec * 0.9 + elapsed * 0.1;
+
+        for (int k = 0; k < n_request; k++) {
+            batch[k]->header = requests[k].header;
+            complete(*batch[k]);  // request must not be touched after this
+        }
+    }
+}
+}
+
+
+void start_inference_thread() {
+    printf("inference thread start\n");
+    init_model();
+    std::thread(run_inference).detach();  // runs until process exit
+}
+
+void add_inproc_client() {
+    n_client++;
+}
+
+void remove_inproc_client() {
+    n_client--;
+}
+
+void submit_request(inproc_request_t& request) {
+    request.state.store(INPROC_PENDING);
+    request.next = queue_head.load();
+    while (!queue_head.compare_exchange_weak(request.next, &request)) {}
+    if (server_waiting.load()) {
+        queue_seq++;
+        futex_wake(queue_seq, /*shared=*/false);
+    }
+}
+
+void wait_request(inproc_request_t& request) {
+    uint32_t expected = INPROC_PENDING;
+    if (request.state.compare_exchange_strong(expected, INPROC_WAITING)) {
+        while (request.state.load() != INPROC_DONE) {
+            futex_wait(request.state, INPROC_WAITING, /*shared=*/false);
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "server.hpp"
+
+
+#define INPROC_PENDING 0
+#define INPROC_WAITING 1  // client sleeps on state
+#define INPROC_DONE 2
+
+
+// request to inference thread in the same process (lives on the stack of the requesting thread)
+typedef struct inproc_request {
+    input_t inputs[1 + MAX_SPECULATIVE];  // main input followed by speculative inputs
+    int n_speculative;
+    response_header_t header;
+    output_t outputs[1 + MAX_SPECULATIVE];
+    std::atomic<uint32_t> state;  // completion of the request (futex word)
+    struct inproc_request *next;  // link in request queue
+} inproc_request_t;
+
+
+void start_inference_thread();
+void add_inproc_client();
+void remove_inproc_client();
+// submit_request() returns immediately, wait_request() returns after outputs are written
+void submit_request(inproc_request_t& request);
+void wait_request(inproc_request_t& request);
@@ -0,0 +1,229 @@
+#include <vector>
+#include <atomic>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+
+#include "metrics.hpp"
+#include "config.hpp"
+
+
+#define MAX_BUCKET 16
+#define N_SIZE_CLASS 11  // forward latency per batch size 1, 2, 4, ..., 512, more
+
+
+namespace {
+typedef struct {
+    const char *name;
+    const char *help;
+    int n_bound;
+    long bounds[MAX_BUCKET];  // upper bounds of buckets (inclusive), followed by +Inf bucket
+    std::atomic<long> counts[MAX_BUCKET + 1];  // not cumulative
+    std::atomic<long> sum;
+    std::atomic<long> count;
+} histogram_t;
+
+const std::vector<long> USEC_BOUNDS = {10, 20, 50, 100, 200, 500, 1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000};
+const char *PRIORITY_NAMES[N_PRIORITY] = {"low", "high"};
+const std::vector<long> PERCENT_BOUNDS = {10, 20, 30, 40, 50, 60, 70, 80, 90, 100};
+
+int max_batch_size = 1;
+histogram_t batch_fill;
+histogram_t request_wait[N_PRIORITY];
+histogram_t request_latency[N_PRIORITY];
+histogram_t stage_time;
+histogram_t forward_time[N_SIZE_CLASS];
+histogram_t reply_time;
+std::atomic<long> n_batch(0);
+std::atomic<long> n_request(0);
+std::atomic<long> n_position(0);
+std::atomic<long> n_padding(0);
+std::atomic<int> n_connected(0);
+
+void init_histogram(histogram_t& h, const char *name, const char *help, const std::vector<long>& bounds) {
+    h.name = name;
+    h.help = help;
+    h.n_bound = bounds.size();
+    std::copy(bounds.begin(), bounds.end(), h.bounds);
+    for (int i = 0; i <= MAX_BUCKET; i++) {
+        h.counts[i] = 0;
+    }
+    h.sum = 0;
+    h.count = 0;
+}
+
+void observe(histogram_t& h, long value) {
+    int i = 0;
+    while (i < h.n_bound && value > h.bounds[i]) {
+        i++;
+    }
+    h.counts[i].fetch_add(1, std::memory_order_relaxed);
+    h.sum.fetch_add(value, std::memory_order_relaxed);
+    h.count.fetch_add(1, std::memory_order_relaxed);
+}
+
+// label is inserted into every sample (e.g. "batch_size=\"4\"")
+void format_histogram(std::ostringstream& oss, const histogram_t& h, const std::string& label, bool with_help) {
+    if (with_help) {
+        oss << "# HELP " << h.name << " " << h.help << "\n";
+        oss << "# TYPE " << h.name << " histogram\n";
+    }
+    std::string sep = label.empty() ? "" : ",";
+    long cumulative = 0;
+    for (int i = 0; i <= h.n_bound; i++) {
+        cumulative += h.counts[i].load(std::memory_order_relaxed);
+        oss << h.name << "_bucket{" << label << sep << "le=\"";
+        if (i < h.n_bound) {
+            oss << h.bounds[i];
+        } else {
+            oss << "+Inf";
+        }
+        oss << "\"} " << cumulative << "\n";
+    }
+    std::string braces = label.empty() ? "" : "{" + label + "}";
+    oss << h.name << "_sum" << braces << " " << h.sum.load(std::memory_order_relaxed) << "\n";
+    oss << h.name << "_count" << braces << " " << h.count.load(std::memory_order_relaxed) << "\n";
+}
+
+// upper bound of the bucket containing quantile q (-1: above the last bound)
+long upper_quantile(const histogram_t& h, float q) {
+    long total = h.count.load(std::memory_order_relaxed);
+    long cumulative = 0;
+    for (int i = 0; i < h.n_bound; i++) {
+        cumulative += h.counts[i].load(std::memory_order_relaxed);
+        if (cumulative >= q * total) {
+            return h.bounds[i];
+        }
+    }
+    return -1;
+}
+
+void format_counter(std::ostringstream& oss, const char *name, const char *type, const char *help, long value) {
+    oss << "# HELP " << name << " " << help << "\n";
+    oss << "# TYPE " << name << " " << type << "\n";
+    oss << name << " " << value << "\n";
+}
+}
+
+
+void init_metrics(int batch_size) {
+    max_batch_size = std::max(batch_size, 1);
+    init_histogram(batch_fill, "omega_batch_fill_percent", "requests in a batch relative to max batch size (n_thread)", PERCENT_BOUNDS);
+    for (int i = 0; i < N_PRIORITY; i++) {
+        init_histogram(request_wait[i], "omega_request_wait_usec", "time from arrival of a request until its batch is closed by priority class", USEC_BOUNDS);
+        init_histogram(request_latency[i], "omega_request_latency_usec", "time from arrival of a request until its response is sent by priority class", USEC_BOUNDS);
+    }
+    init_histogram(stage_time, "omega_stage_usec", "time to place and unpack inputs of a batch", USEC_BOUNDS);
+    for (int i = 0; i < N_SIZE_CLASS; i++) {
+        init_histogram(forward_time[i], "omega_forward_usec", "time of forward pass of a batch by batch size (at most batch_size rows including padding)", USEC_BOUNDS);
+    }
+    init_histogram(reply_time, "omega_reply_usec", "time to copy outputs and send responses of a batch", USEC_BOUNDS);
+}
+
+void observe_batch(int n) {
+    observe(batch_fill, n * 100L / max_batch_size);
+    n_batch.fetch_add(1, std::memory_order_relaxed);
+    n_request.fetch_add(n, std::memory_order_relaxed);
+}
+
+void observe_request_wait(int priority, long usec) {
+    observe(request_wait[priority], usec);
+}
+
+void observe_latency(int priority, long usec) {
+    observe(request_latency[priority], usec);
+}
+
+void observe_stage(long usec) {
+    observe(stage_time, usec);
+}
+
+void observe_forward(int n_row, int n_pad, long usec) {
+    int size_class = 0;
+    while (size_class < N_SIZE_CLASS - 1 && (1 << size_class) < n_row) {
+        size_class++;
+    }
+    observe(forward_time[size_class], usec);
+    n_position.fetch_add(n_row - n_pad, std::memory_order_relaxed);
+    n_padding.fetch_add(n_pad, std::memory_order_relaxed);
+}
+
+void observe_reply(long usec) {
+    observe(reply_time, usec);
+}
+
+void set_connected_clients(int n_client) {
+    n_connected.store(n_client, std::memory_order_relaxed);
+}
+
+std::string format_metrics() {
+    std::ostringstream oss;
+    format_counter(oss, "omega_batches_total", "counter", "batches closed", n_batch.load(std::memory_order_relaxed));
+    format_counter(oss, "omega_requests_total", "counter", "requests (main inputs) evaluated", n_request.load(std::memory_order_relaxed));
+    format_counter(oss, "omega_positions_total", "counter", "positions evaluated including speculative inputs", n_position.load(std::memory_order_relaxed));
+    format_counter(oss, "omega_padding_rows_total", "counter", "rows run without input (bucket padding)", n_padding.load(std::memory_order_relaxed));
+    format_counter(oss, "omega_connected_clients", "gauge", "clients connected to server", n_connected.load(std::memory_order_relaxed));
+    format_histogram(oss, batch_fill, "", true);
+    for (int i = 0; i < N_PRIORITY; i++) {
+        format_histogram(oss, request_wait[i], "priority=\"" + std::string(PRIORITY_NAMES[i]) + "\"", i == 0);
+    }
+    for (int i = 0; i < N_PRIORITY; i++) {
+        format_histogram(oss, request_latency[i], "priority=\"" + std::string(PRIORITY_NAMES[i]) + "\"", i == 0);
+    }
+    format_histogram(oss, stage_time, "", true);
+    for (int i = 0; i < N_SIZE_CLASS; i++) {
+        std::string size = (i < N_SIZE_CLASS - 1) ? std::to_string(1 << i) : "+Inf";
+        format_histogram(oss, forward_time[i], "batch_size=\"" + size + "\"", i == 0);
+    }
+    format_histogram(oss, reply_time, "", true);
+    return oss.str();
+}
+
+std::string format_batch_summary() {
+    long batches = std::max(n_batch.load(std::memory_order_relaxed), 1L);
+    long requests = n_request.load(std::memory_order_relaxed);
+    long rows = std::max(n_position.load(std::memory_order_relaxed) + n_padding.load(std::memory_order_relaxed), 1L);
+    std::ostringstream oss;
+    oss.precision(3);
+    oss << "batch fill mean=" << 100.0 * requests / (batches * max_batch_size) << "%"
+        << " requests/batch=" << (double)requests / batches
+        << " padding=" << 100.0 * n_padding.load(std::memory_order_relaxed) / rows << "%";
+    return oss.str();
+}
+
+std::string format_latency_summary() {
+    std::ostringstream oss;
+    oss << "latency";
+    for (int i = 0; i < N_PRIORITY; i++) {
+        const histogram_t& h = request_latency[i];
+        long n = h.count.load(std::memory_order_relaxed);
+        oss << " " << PRIORITY_NAMES[i] << ": n=" << n;
+        if (n == 0) {
+            continue;
+        }
+        oss << " mean=" << h.sum.load(std::memory_order_relaxed) / n << "usec";
+        for (float q : {0.5f, 0.99f}) {
+            long bound = upper_quantile(h, q);
+            oss << " p" << (int)(q * 100) << (bound < 0 ? ">" : "<=") << (bound < 0 ? h.bounds[h.n_bound - 1] : bound);
+        }
+    }
+    return oss.str();
+}
+
+void write_metrics_file(const char *fname) {
+    std::string tmp_fname = std::string(fname) + ".tmp";
+    std::ofstream ofs(tmp_fname);
+    if (ofs.fail()) {
+        fprintf(stderr, "cannot open file \"%s\"\n", tmp_fname.c_str());
+        return;
+    }
+    ofs << format_metrics();
+    ofs.close();
+    if (rename(tmp_fname.c_str(), fname) < 0) {
+        fprintf(stderr, "rename error %s\n", strerror(errno));
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <string>
+
+
+// always-on counters and histograms of inference server (lock-free, relaxed atomics)
+// exported in Prometheus text format by format_metrics()
+
+void init_metrics(int batch_size);  // batch_size : max requests of a batch (n_thread)
+
+void observe_batch(int n_request);  // batch closed by I/O thread
+void observe_request_wait(int priority, long usec);  // from arrival of request until its batch is closed
+void observe_latency(int priority, long usec);  // from arrival of request until its response is sent
+void observe_stage(long usec);
+void observe_forward(int n_row, int n_padding, long usec);  // n_row : rows run including padding
+void observe_reply(long usec);
+void set_connected_clients(int n_client);
+
+std::string format_metrics();
+std::string format_batch_summary();  // one line of mean batch fill and share of padding rows
+std::string format_latency_summary();  // one line of count, mean and percentiles of latency per priority class
+void write_metrics_file(const char *fname);  // replaced atomically
@@ -1,149 +1,332 @@
 #include <torch/torch.h>
+#include <torch/script.h>
 #include <iostream>
 #include <vector>
+#include <tuple>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cassert>
+#include <csignal>
+#include <sys/stat.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 #include "model.hpp"
 #include "server.hpp"
 #include "config.hpp"
 
 
-// /**
-//     DO NOT use assignment operations because they can cause unintended change of parameters
-// **/
+namespace {
+    torch::Device device{torch::kCPU};
+    std::vector<std::vector<torch::jit::script::Module>> omega_nets;  // indexed by worker id, model id
+    thread_local int worker_index = 0;
 
-ResBlockImpl::ResBlockImpl(int n_filter) {
-    conv1 = register_module("conv1", torch::nn::Conv2d(
-        torch::nn::Conv2dOptions(n_filter, n_filter, 3).padding(1).bias(false)
-    ));
-    bn1 = register_module("bn1", torch::nn::BatchNorm2d(n_filter));
-    conv2 = register_module("conv2", torch::nn::Conv2d(
-        torch::nn::Conv2dOptions(n_filter, n_filter, 3).padding(1).bias(false)
-    ));
-    bn2 = register_module("bn2", torch::nn::BatchNorm2d(n_filter));
-}
+// input tensors allocated once and reused by every batch (pinned for fast transfer to GPU)
+typedef struct {
+    torch::Tensor black_board;  // [n_thread, 8, 8]
+    torch::Tensor white_board;  // [n_thread, 8, 8]
+    torch::Tensor side;  // [n_thread]
+    torch::Tensor legal_flags;  // [n_thread, 64]
+} staging_t;
+
+std::vector<int> player_models;  // model id of each player
+
+// file of each model (indexed by model id)
+typedef struct {
+    const char *fname;
+    long mtime;  // modification time of loaded weights (nsec)
+} model_spec_t;
 
-torch::Tensor ResBlockImpl::forward(const torch::Tensor& x) {
-    torch::Tensor identity = x;
-    torch::Tensor y = x;
-    y = torch::relu(bn1(conv1(y)));
-    y = bn2(conv2(y));
-    y = torch::relu(y + identity);
-    return y;
+std::vector<model_spec_t> model_specs;
+
+// weights reloaded in background are swapped in by each worker between batches
+std::mutex reload_mutex;
+std::vector<std::vector<torch::jit::script::Module>> reloaded_nets;  // indexed by worker id, model id
+std::vector<int> reloaded_generations;  // number of reloads of each model
+std::atomic<int> n_reload(0);
+std::vector<int> worker_n_reload;  // reloads applied by each worker
+std::vector<std::vector<int>> generations;  // generation of weights used by each worker, indexed by worker id, model id
+volatile sig_atomic_t reload_requested = 0;
+std::vector<std::vector<std::vector<staging_t>>> stagings;  // indexed by worker id, model id, buffer id
+bool use_avx2 = false;
+
+staging_t make_staging(int n_row) {
+    auto options = torch::TensorOptions().dtype(torch::kFloat32).pinned_memory(device.is_cuda());
+    return {torch::zeros({n_row, 8, 8}, options), torch::zeros({n_row, 8, 8}, options), torch::zeros({n_row}, options), torch::zeros({n_row, 64}, options)};
 }
 
+// bit j of board -> out[j] (1.0 or 0.0)
+void unpack_board(BitBoard board, float *out) {
+    for (int j = 0; j < 64; j++) {
+        out[j] = static_cast<float>((board >> j) & 1);
+    }
+}
 
-OmegaNetImpl::OmegaNetImpl(int board_size, int n_action, int n_res_block, int res_filter, int policy_filter, int value_filter, int value_hidden) {
-    // input channel : player's board, opponent's board
-    conv = register_module("conv", torch::nn::Sequential(
-        torch::nn::Conv2d(torch::nn::Conv2dOptions(2, res_filter, 3).padding(1).bias(false)),
-        torch::nn::BatchNorm2d(res_filter),
-        torch::nn::ReLU(torch::nn::ReLUOptions().inplace(true))
-    ));
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+void unpack_board_avx2(BitBoard board, float *out) {
+    const __m256i bits = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256 ones = _mm256_set1_ps(1.0f);
+    for (int i = 0; i < 8; i++) {
+        __m256i byte = _mm256_set1_epi32((board >> (8 * i)) & 0xff);
+        __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(byte, bits), bits);
+        _mm256_storeu_ps(out + 8 * i, _mm256_and_ps(_mm256_castsi256_ps(mask), ones));
+    }
+}
+#endif
 
-    res_blocks = register_module("res_blocks", torch::nn::Sequential());
-    for (int i = 0; i < n_res_block; i++) {
-        res_blocks->push_back(ResBlock(res_filter));
+// write inputs directly into staging tensors
+void unpack(const input_t * const *recv_data, int n_row, staging_t& staging) {
+    float *black_board_arr = staging.black_board.data_ptr<float>();
+    float *white_board_arr = staging.white_board.data_ptr<float>();
+    float *side_arr = staging.side.data_ptr<float>();
+    float *legal_flags_arr = staging.legal_flags.data_ptr<float>();
+#if defined(__x86_64__)
+    if (use_avx2) {
+        for (int i = 0; i < n_row; i++) {
+            unpack_board_avx2(recv_data[i]->black_board, black_board_arr + i * 64);
+            unpack_board_avx2(recv_data[i]->white_board, white_board_arr + i * 64);
+            unpack_board_avx2(recv_data[i]->legal_board, legal_flags_arr + i * 64);
+            side_arr[i] = static_cast<float>(recv_data[i]->side);
+        }
+        return;
+    }
+#endif
+    for (int i = 0; i < n_row; i++) {
+        unpack_board(recv_data[i]->black_board, black_board_arr + i * 64);
+        unpack_board(recv_data[i]->white_board, white_board_arr + i * 64);
+        unpack_board(recv_data[i]->legal_board, legal_flags_arr + i * 64);
+        side_arr[i] = static_cast<float>(recv_data[i]->side);
     }
+}
+
+std::tuple<torch::Tensor, torch::Tensor> run_model(torch::jit::script::Module& omega_net, const torch::Tensor& black_board, const torch::Tensor& white_board, const torch::Tensor& side, const torch::Tensor& legal_flags) {
+    c10::InferenceMode guard;
+    auto outputs = omega_net.forward({black_board, white_board, side, legal_flags}).toTuple();
+    return std::make_tuple(outputs->elements()[0].toTensor(), outputs->elements()[1].toTensor());
+}
 
-    policy_head = register_module("policy_head", torch::nn::Sequential(
-        torch::nn::Conv2d(torch::nn::Conv2dOptions(res_filter, policy_filter, 1).padding(0).bias(false)),
-        torch::nn::BatchNorm2d(policy_filter),
-        torch::nn::Flatten(),
-        torch::nn::ReLU(torch::nn::ReLUOptions().inplace(true)),
-        torch::nn::Linear(policy_filter * board_size * board_size, n_action)
-    ));
+// profiling executor specializes the graph in the first runs, so that the first batches are not slow
+void warm_up(torch::jit::script::Module& omega_net) {
+    const auto& config = get_config();
 
-    value_head = register_module("value_head", torch::nn::Sequential(
-        torch::nn::Conv2d(torch::nn::Conv2dOptions(res_filter, value_filter, 1).padding(0).bias(false)),
-        torch::nn::BatchNorm2d(value_filter),
-        torch::nn::Flatten(),
-        torch::nn::ReLU(torch::nn::ReLUOptions().inplace(true)),
-        torch::nn::Linear(value_filter * board_size * board_size, value_hidden),
-        torch::nn::ReLU(torch::nn::ReLUOptions().inplace(true)),
-        torch::nn::Linear(value_hidden, 1)
-    ));
+    Board board;  // initial position
+    input_t input = {board.get_black_board(), board.get_white_board(), board.make_legal_board(Side::BLACK), Side::BLACK, 0, 0, 0};
+    for (int n_row : {config.n_thread, 1}) {
+        std::vector<const input_t*> inputs(n_row, &input);
+        staging_t staging = make_staging(n_row);
+        unpack(inputs.data(), n_row, staging);
+        for (int k = 0; k < 3; k++) {
+            run_model(omega_net, staging.black_board.to(device), staging.white_board.to(device), staging.side.to(device), staging.legal_flags.to(device));
+        }
+    }
+}
+
+// load traced model, freeze it (parameters become constants, BatchNorm is folded into convolutions)
+// and apply inference passes (conv + ReLU fusion, MKLDNN layout on CPU), keep omega_net unchanged on failure
+bool load_model(const model_spec_t& spec, torch::jit::script::Module& omega_net) {
+    torch::jit::script::Module loaded;
+    try {
+        printf("load model %s\n", basename(spec.fname));
+        loaded = torch::jit::load(spec.fname, device);
+        loaded.eval();
+        torch::jit::script::Module frozen = torch::jit::freeze(loaded);
+        loaded = torch::jit::optimize_for_inference(frozen);
+        warm_up(loaded);
+    } catch (const c10::Error& e) {
+        fprintf(stderr, "error loading the model %s (%s)\n", spec.fname, e.what_without_backtrace());
+        return false;
+    }
+    omega_net = loaded;
+    return true;
 }
 
-std::tuple<torch::Tensor, torch::Tensor> OmegaNetImpl::forward(const torch::Tensor& black_board, const torch::Tensor& white_board, const torch::Tensor& side, const torch::Tensor& legal_flags) {
-    torch::Tensor side_board = side.view({-1, 1, 1});
-    torch::Tensor player_board = black_board * (1 - side_board) + white_board * side_board;
-    torch::Tensor opponent_board = black_board * side_board + white_board * (1 - side_board);
-    torch::Tensor x = torch::stack({player_board, opponent_board}, 1);
-    x = res_blocks->forward(conv->forward(x));
+long get_mtime(const char *fname) {
+    struct stat st;
+    if (stat(fname, &st) < 0) {
+        return -1;
+    }
+    return st.st_mtim.tv_sec * 1000000000L + st.st_mtim.tv_nsec;
+}
 
-    torch::Tensor policy_logit = policy_head->forward(x);
-    torch::Tensor policy = policy_logit + (legal_flags + 1e-45).log();
-    policy = torch::softmax(policy, /*dim=*/ 1);
+void handle_sighup(int) {
+    reload_requested = 1;
+}
 
-    torch::Tensor value_pred = torch::tanh(value_head->forward(x));
-    value_pred = value_pred.squeeze(1);
+// load weights of models in background (workers keep running batches with current weights)
+void reload_models(const std::vector<int>& model_ids) {
+    int n_worker = omega_nets.size();
+    for (int model_id : model_ids) {
+        model_spec_t& spec = model_specs[model_id];
+        long mtime = get_mtime(spec.fname);  // before loading, so that a file written meanwhile is loaded again
+        std::vector<torch::jit::script::Module> nets(n_worker);
+        bool loaded = true;
+        for (int worker_id = 0; worker_id < n_worker && loaded; worker_id++) {
+            loaded = load_model(spec, nets[worker_id]);
+        }
+        if (!loaded) {  // e.g. file is being written, retried at next check
+            fprintf(stderr, "keep current weights of %s\n", basename(spec.fname));
+            continue;
+        }
 
-    return std::make_tuple(policy, value_pred);
+        std::lock_guard<std::mutex> lock(reload_mutex);
+        for (int worker_id = 0; worker_id < n_worker; worker_id++) {
+            reloaded_nets[worker_id][model_id] = nets[worker_id];
+        }
+        reloaded_generations[model_id]++;
+        spec.mtime = mtime;
+        n_reload++;
+        printf("reloaded model %s (generation %d)\n", basename(spec.fname), reloaded_generations[model_id]);
+    }
 }
 
+// reload models on SIGHUP, or when their files are modified if model_watch_msec > 0
+void watch_models() {
+    const auto& config = get_config();
 
-namespace {
-    torch::Device device{torch::kCPU};
-    OmegaNet omega_net{nullptr};
+    int interval_msec = (config.model_watch_msec > 0) ? config.model_watch_msec : 100;
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(interval_msec));
+        bool requested = reload_requested;
+        reload_requested = 0;
+
+        std::vector<int> model_ids;
+        for (unsigned int model_id = 0; model_id < model_specs.size(); model_id++) {
+            bool modified = (config.model_watch_msec > 0 && get_mtime(model_specs[model_id].fname) != model_specs[model_id].mtime);
+            if (requested || modified) {
+                model_ids.push_back(model_id);
+            }
+        }
+        if (!model_ids.empty()) {
+            reload_models(model_ids);
+        }
+    }
+}
+
+// swap in weights reloaded since the last batch of calling worker
+void update_worker() {
+    if (n_reload.load() == worker_n_reload[worker_index]) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(reload_mutex);
+    omega_nets[worker_index] = reloaded_nets[worker_index];
+    generations[worker_index] = reloaded_generations;
+    worker_n_reload[worker_index] = n_reload.load();
+}
 }
 
-void init_model() {
+void init_model(int n_worker) {
     const auto& config = get_config();
 
     if (torch::cuda::is_available() && config.device_id >= 0) {
         device = {torch::kCUDA, (short int)config.device_id};
     }
     std::cout << "using " << device << std::endl;
+    if (config.n_intra_thread > 0) {  // one intra-op thread pool of the process is shared by all workers
+        torch::set_num_threads(config.n_intra_thread);
+    }
+#if defined(__x86_64__)
+    use_avx2 = __builtin_cpu_supports("avx2");
+#endif
 
-    omega_net = OmegaNet(config.board_size, config.n_action, config.n_res_block, config.res_filter, config.policy_filter, config.value_filter, config.value_hidden);
-    try {
-        printf("load model %s\n", basename(config.model_fname));
-        torch::load(omega_net, config.model_fname);
-    } catch (const c10::Error& e) {
-        fprintf(stderr, "error loading the model %s\n", config.model_fname);
-        exit(-1);
+    model_specs.push_back({config.model_fname, 0});
+    if (config.small_depth > 0 || config.small_visits > 0) {
+        model_specs.push_back({config.small_model_fname, 0});
+    }
+    player_models.assign(1, MODEL_MAIN);
+    for (int player = 1; player < config.n_player; player++) {
+        player_models.push_back(model_specs.size());
+        model_specs.push_back({config.player_model_fnames[player], 0});
+    }
+    for (auto& spec : model_specs) {
+        spec.mtime = get_mtime(spec.fname);
+    }
+
+    int n_model = model_specs.size();
+    omega_nets.assign(n_worker, std::vector<torch::jit::script::Module>(n_model));
+    stagings.resize(n_worker);
+    for (int worker_id = 0; worker_id < n_worker; worker_id++) {
+        for (int model_id = 0; model_id < n_model; model_id++) {
+            if (!load_model(model_specs[model_id], omega_nets[worker_id][model_id])) {
+                exit(-1);
+            }
+            stagings[worker_id].emplace_back();
+            for (int buffer_id = 0; buffer_id < N_STAGING; buffer_id++) {
+                stagings[worker_id][model_id].push_back(make_staging(config.n_thread));
+            }
+        }
     }
-    omega_net->to(device);
-    omega_net->eval();
+    reloaded_nets = omega_nets;
+    reloaded_generations.assign(n_model, 0);
+    generations.assign(n_worker, reloaded_generations);
+    worker_n_reload.assign(n_worker, 0);
+
+    signal(SIGHUP, handle_sighup);
+    std::thread(watch_models).detach();
+}
+
+// call in every thread that stages or runs batches of the worker
+void bind_worker(int worker_id) {
+    worker_index = worker_id;
+}
+
+int get_n_model() {
+    return model_specs.size();  // omega_nets may be swapped by workers meanwhile
+}
+
+// route requests of other players to their models, deep or rarely visited leaves to the small model
+int select_model(const input_t& input) {
+    if (input.player > 0) {
+        assert(input.player < player_models.size());
+        return player_models[input.player];
+    }
+    return use_small_model(input.depth, input.visits) ? MODEL_SMALL : MODEL_MAIN;
 }
 
-void inference(const input_t *recv_data, output_t *send_data) {
+bool use_small_model(int depth, int visits) {
     const auto& config = get_config();
 
-    float *black_board_arr = new float[config.n_thread * 64];  // TODO: ok?
-    float *white_board_arr = new float[config.n_thread * 64];
-    float *side_arr = new float[config.n_thread];
-    float *legal_flags_arr = new float[config.n_thread * 64];
-    for (int i = 0; i < config.n_thread; i++) {
-        for (int j = 0; j < 64; j++) {
-            black_board_arr[i*64+j] = static_cast<float>((recv_data[i].black_board >> j) & 1);
-            white_board_arr[i*64+j] = static_cast<float>((recv_data[i].white_board >> j) & 1);
-            legal_flags_arr[i*64+j] = static_cast<float>(recv_data[i].legal_flags[j]);
-        }
-        side_arr[i] = static_cast<float>(recv_data[i].side);
+    if ((config.small_depth <= 0 && config.small_visits <= 0) || depth == 0) {  // no small model
+        return false;
+    }
+    if (config.small_depth > 0 && depth >= config.small_depth) {
+        return true;
     }
+    return config.small_visits > 0 && visits < config.small_visits;
+}
+
+void stage(int model_id, int buffer_id, const input_t * const *recv_data, int n_row) {
+    staging_t& staging = stagings[worker_index][model_id][buffer_id];
+    assert(n_row <= staging.side.size(0));
+    unpack(recv_data, n_row, staging);
+}
+
+int forward(int model_id, int buffer_id, output_t *send_data, int n_row) {
+    update_worker();
+    torch::jit::script::Module& omega_net = omega_nets[worker_index][model_id];
+    staging_t& staging = stagings[worker_index][model_id][buffer_id];
 
-    torch::Tensor black_board_b = torch::from_blob(black_board_arr, {config.n_thread, 8, 8}).to(device);
-    torch::Tensor white_board_b = torch::from_blob(white_board_arr, {config.n_thread, 8, 8}).to(device);
-    torch::Tensor side_b = torch::from_blob(side_arr, {config.n_thread}).to(device);
-    torch::Tensor legal_flags_b = torch::from_blob(legal_flags_arr, {config.n_thread, 64}).to(device);
+    // views of the first n_row rows (to() does not copy on CPU)
+    torch::Tensor black_board_b = staging.black_board.narrow(0, 0, n_row).to(device, /*non_blocking=*/true);
+    torch::Tensor white_board_b = staging.white_board.narrow(0, 0, n_row).to(device, /*non_blocking=*/true);
+    torch::Tensor side_b = staging.side.narrow(0, 0, n_row).to(device, /*non_blocking=*/true);
+    torch::Tensor legal_flags_b = staging.legal_flags.narrow(0, 0, n_row).to(device, /*non_blocking=*/true);
 
     torch::Tensor policy_b, value_pred_b;
-    {
-        torch::NoGradGuard no_grad;
-        std::tie(policy_b, value_pred_b) = omega_net->forward(black_board_b, white_board_b, side_b, legal_flags_b);
-    }
+    std::tie(policy_b, value_pred_b) = run_model(omega_net, black_board_b, white_board_b, side_b, legal_flags_b);
 
-    policy_b = policy_b.to(torch::kCPU);
-    value_pred_b = value_pred_b.to(torch::kCPU);
+    // traced model (python/model.py) returns log-probabilities, priors are probabilities
+    policy_b = policy_b.exp().to(torch::kCPU).contiguous();
+    value_pred_b = value_pred_b.to(torch::kCPU).contiguous();
 
-    float *value_pred_arr = (float*)value_pred_b.data_ptr();
-    for (int i = 0; i < config.n_thread; i++) {
-        memcpy(send_data[i].priors, policy_b[i].data_ptr(), sizeof(float)*64);
+    const float *policy_arr = policy_b.data_ptr<float>();
+    const float *value_pred_arr = value_pred_b.data_ptr<float>();
+    for (int i = 0; i < n_row; i++) {
+        memcpy(send_data[i].priors, policy_arr + i * 64, sizeof(float) * 64);
         send_data[i].value = value_pred_arr[i];
     }
-
-    delete[] black_board_arr;
-    delete[] white_board_arr;
-    delete[] side_arr;
+    return generations[worker_index][model_id];
 }
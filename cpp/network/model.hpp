@@ -1,32 +1,22 @@
-#include <torch/torch.h>
-#include <tuple>
+#pragma once
 
 #include "server.hpp"
 
 
-struct ResBlockImpl : torch::nn::Module {
-    ResBlockImpl(int n_filter);
+// models are TorchScript files traced by python/train_model.py (model_jit_*.pt),
+// frozen and optimized for inference when loaded (BatchNorm folded into convolutions)
 
-    torch::Tensor forward(const torch::Tensor& x);
+#define MODEL_MAIN 0
+#define MODEL_SMALL 1  // small model for deep leaves
 
-    torch::nn::Conv2d conv1{nullptr}, conv2{nullptr};
-    torch::nn::BatchNorm2d bn1{nullptr}, bn2{nullptr};
-};
+void init_model(int n_worker = 1);  // load a replica of models for each worker
+void bind_worker(int worker_id);  // use replica of worker in calling thread
+int get_n_model();
+int select_model(const input_t& input);
+bool use_small_model(int depth, int visits);  // routing of main player's leaves (also used by clients to key cached results)
+#define N_STAGING 2  // staging buffers per model (next batch is staged while a batch runs)
 
-TORCH_MODULE(ResBlock);
-
-struct OmegaNetImpl : torch::nn::Module {
-    OmegaNetImpl(int board_size, int n_action, int n_res_block, int res_filter, int policy_filter, int value_filter, int value_hidden);
-
-    std::tuple<torch::Tensor, torch::Tensor> forward(const torch::Tensor& black_board, const torch::Tensor& white_board, const torch::Tensor& side, const torch::Tensor& legal_flags);
-
-    torch::nn::Sequential conv{nullptr};
-    torch::nn::Sequential res_blocks{nullptr};
-    torch::nn::Sequential policy_head{nullptr};
-    torch::nn::Sequential value_head{nullptr};
-};
-
-TORCH_MODULE(OmegaNet);
-
-void init_model();
-void inference(const input_t *recv_data, output_t *send_data);
+// write inputs into staging buffer, then run model on the buffer (may be called from different threads)
+// forward() returns generation of the weights (number of reloads of the model, see watch_models())
+void stage(int model_id, int buffer_id, const input_t * const *recv_data, int n_row);
+int forward(int model_id, int buffer_id, output_t *send_data, int n_row);
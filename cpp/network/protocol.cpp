@@ -0,0 +1,145 @@
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "protocol.hpp"
+
+
+namespace {
+// fp32 <-> fp16 (round to nearest, priors and values are finite)
+uint16_t float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint16_t sign = (x >> 16) & 0x8000;
+    int exp = (int)((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+    if (exp >= 31) {  // too large
+        return sign | 0x7c00;
+    }
+    if (exp <= 0) {  // subnormal
+        if (exp < -10) {
+            return sign;
+        }
+        mant |= 0x800000;
+        int shift = 14 - exp;
+        uint32_t half = mant >> shift;
+        half += (mant >> (shift - 1)) & 1;
+        return sign | half;
+    }
+    uint32_t half = ((uint32_t)exp << 10) | (mant >> 13);
+    half += (mant >> 12) & 1;  // a carry into exponent is still correct
+    return sign | half;
+}
+
+float half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    int exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    if (exp == 0) {  // subnormal
+        float f = std::ldexp((float)mant, -24);
+        return sign ? -f : f;
+    }
+    uint32_t x = sign | ((uint32_t)(exp - 15 + 127) << 23) | (mant << 13);
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+size_t prior_size(uint8_t flags) {
+    return (flags & PROTOCOL_FP16) ? sizeof(uint16_t) : sizeof(float);
+}
+
+void put_frame_header(uint8_t flags, int n_position, std::vector<char>& buf) {
+    frame_header_t header = {PROTOCOL_VERSION, flags, (uint16_t)n_position};
+    buf.resize(sizeof(frame_header_t));
+    memcpy(buf.data(), &header, sizeof(frame_header_t));
+}
+}
+
+
+void encode_request(const input_t *inputs, int n_position, uint8_t flags, std::vector<char>& buf) {
+    put_frame_header(flags, n_position, buf);
+    buf.resize(sizeof(frame_header_t) + sizeof(wire_input_t) * n_position);
+    encode_inputs(inputs, n_position, reinterpret_cast<wire_input_t*>(buf.data() + sizeof(frame_header_t)));
+}
+
+void encode_inputs(const input_t *inputs, int n_position, wire_input_t *wire_inputs) {
+    for (int k = 0; k < n_position; k++) {
+        const input_t& input = inputs[k];
+        wire_input_t wire = {input.black_board, input.white_board, input.legal_board, (uint8_t)input.side, input.depth, input.player, (uint32_t)input.visits};
+        memcpy(&wire_inputs[k], &wire, sizeof(wire_input_t));
+    }
+}
+
+void decode_inputs(const wire_input_t *wire_inputs, int n_position, input_t *inputs) {
+    for (int k = 0; k < n_position; k++) {
+        const wire_input_t& wire = wire_inputs[k];
+        inputs[k].black_board = wire.black_board;
+        inputs[k].white_board = wire.white_board;
+        inputs[k].legal_board = wire.legal_board;
+        inputs[k].side = (Side)wire.side;
+        inputs[k].depth = wire.depth;
+        inputs[k].player = wire.player;
+        inputs[k].visits = wire.visits;
+    }
+}
+
+void encode_response(const response_header_t& header, const input_t *inputs, const output_t *outputs, uint8_t flags, std::vector<char>& buf) {
+    int n_position = 1 + header.n_evaluated;
+    put_frame_header(flags, n_position, buf);
+    buf.resize(sizeof(frame_header_t) + response_size(inputs, n_position, flags));
+    char *p = buf.data() + sizeof(frame_header_t);
+
+    wire_response_t wire = {header.n_free, header.model_generation};
+    memcpy(p, &wire, sizeof(wire_response_t));
+    p += sizeof(wire_response_t);
+    for (int k = 0; k < n_position; k++) {
+        memcpy(p, &outputs[k].value, sizeof(float));
+        p += sizeof(float);
+        for (BitBoard b = inputs[k].legal_board; b; b &= b - 1) {
+            float prior = outputs[k].priors[__builtin_ctzll(b)];
+            if (flags & PROTOCOL_FP16) {
+                uint16_t half = float_to_half(prior);
+                memcpy(p, &half, sizeof(uint16_t));
+            } else {
+                memcpy(p, &prior, sizeof(float));
+            }
+            p += prior_size(flags);
+        }
+    }
+}
+
+size_t response_size(const input_t *inputs, int n_position, uint8_t flags) {
+    size_t size = sizeof(wire_response_t);
+    for (int k = 0; k < n_position; k++) {
+        size += sizeof(float) + prior_size(flags) * __builtin_popcountll(inputs[k].legal_board);
+    }
+    return size;
+}
+
+void decode_response(const char *buf, const input_t *inputs, int n_position, uint8_t flags, response_header_t& header, output_t *outputs) {
+    const char *p = buf;
+    wire_response_t wire;
+    memcpy(&wire, p, sizeof(wire_response_t));
+    p += sizeof(wire_response_t);
+    header.n_evaluated = n_position - 1;
+    header.n_free = wire.n_free;
+    header.model_generation = wire.model_generation;
+
+    for (int k = 0; k < n_position; k++) {
+        memcpy(&outputs[k].value, p, sizeof(float));
+        p += sizeof(float);
+        std::fill(std::begin(outputs[k].priors), std::end(outputs[k].priors), 0.0f);
+        for (BitBoard b = inputs[k].legal_board; b; b &= b - 1) {
+            float& prior = outputs[k].priors[__builtin_ctzll(b)];
+            if (flags & PROTOCOL_FP16) {
+                uint16_t half;
+                memcpy(&half, p, sizeof(uint16_t));
+                prior = half_to_float(half);
+            } else {
+                memcpy(&prior, p, sizeof(float));
+            }
+            p += prior_size(flags);
+        }
+    }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "server.hpp"
+
+
+// framed binary protocol between clients and inference server over socket (unix or TCP)
+// request  : frame_header_t, n_position x wire_input_t (main position followed by speculative positions)
+// response : frame_header_t (n_position: evaluated positions), wire_response_t,
+//            then for each position its value (fp32) and priors of legal moves in order of square (fp32 or fp16)
+// integers are sent in byte order of the host (server and clients run on the same architecture)
+
+#define PROTOCOL_VERSION 1
+#define PROTOCOL_FP16 0x01  // priors are sent as fp16
+#define PROTOCOL_HIGH_PRIORITY 0x02  // request of interactive client (see PRIORITY_HIGH)
+
+typedef struct __attribute__((packed)) {
+    uint8_t version;
+    uint8_t flags;
+    uint16_t n_position;
+} frame_header_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t black_board;
+    uint64_t white_board;
+    uint64_t legal_board;
+    uint8_t side;
+    uint8_t depth;
+    uint8_t player;
+    uint32_t visits;
+} wire_input_t;
+
+typedef struct __attribute__((packed)) {
+    int32_t n_free;
+    int32_t model_generation;
+} wire_response_t;
+
+
+void encode_request(const input_t *inputs, int n_position, uint8_t flags, std::vector<char>& buf);  // with frame header
+void encode_inputs(const input_t *inputs, int n_position, wire_input_t *wire_inputs);
+void decode_inputs(const wire_input_t *wire_inputs, int n_position, input_t *inputs);
+
+// inputs are the positions of the request (only priors of their legal moves are sent)
+void encode_response(const response_header_t& header, const input_t *inputs, const output_t *outputs, uint8_t flags, std::vector<char>& buf);  // with frame header
+size_t response_size(const input_t *inputs, int n_position, uint8_t flags);  // without frame header
+void decode_response(const char *buf, const input_t *inputs, int n_position, uint8_t flags, response_header_t& header, output_t *outputs);
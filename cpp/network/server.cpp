@@ -1,18 +1,41 @@
 #include <iostream>
+#include <string>
 #include <vector>
+#include <map>
+#include <mutex>
+#include <deque>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <numeric>
 #include <thread>
 #include <cstring>
 #include <cstdarg>
+#include <cassert>
 #include <chrono>
 #include <unistd.h>
-#include <sys/select.h>
-#include <sys/time.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/time.h>
 #include <sys/un.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <csignal>
 
 #include "server.hpp"
 #include "model.hpp"
+#include "heuristic.hpp"
+#include "shm.hpp"
+#include "batch.hpp"
+#include "inproc.hpp"
+#include "protocol.hpp"
+#include "metrics.hpp"
+#include "trace.hpp"
 #include "board.hpp"
 #include "config.hpp"
 
@@ -20,28 +43,246 @@
 #define PIPE_READ  0
 #define PIPE_WRITE 1
 
+#define METRICS_TIMEOUT_SEC 1  // a scraper connection is dropped if it does not send its request or take the response in time
+
 
 namespace {
 
-struct sockaddr_un server_addr;
-char socket_path[100];
+char socket_path[100];  // of server process created by this process
 
-int connect_to_clients(int pipe_fd, std::vector<int>& client_socks) {
-    const auto& config = get_config();
+// client-side state for speculative evaluation
+thread_local int n_free = 0;  // spare batch capacity reported by server
+thread_local std::vector<input_t> speculative_inputs;
+thread_local std::map<std::tuple<BitBoard, BitBoard, Side, int, bool>, output_t> eval_cache;  // by position, player and small model
+thread_local int current_player = 0;
+thread_local int model_generation = 0;  // of the last response
+std::atomic<long> n_evaluation(0);  // positions evaluated by NN for this process
+
+// client-side shared-memory slot of each connection
+std::mutex slot_mutex;
+std::map<int, int> sock_slots;
+std::atomic<int> slot_generation(0);  // changed by every connection (a socket number may be reused with another slot)
+
+int get_slot(int server_sock) {
+    thread_local int cached_sock = -1;
+    thread_local int cached_slot = -1;
+    thread_local int cached_generation = -1;
+    if (server_sock != cached_sock || slot_generation.load() != cached_generation) {
+        std::lock_guard<std::mutex> lock(slot_mutex);
+        auto it = sock_slots.find(server_sock);
+        cached_slot = (it != sock_slots.end()) ? it->second : -1;
+        cached_sock = server_sock;
+        cached_generation = slot_generation.load();
+    }
+    return cached_slot;
+}
+
+// read exactly size bytes (return 0 if disconnected)
+int read_all(int fd, void *buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        int retval = read(fd, (char*)buf + done, size - done);
+        if (retval <= 0) {
+            return retval;
+        }
+        done += retval;
+    }
+    return done;
+}
+
+void write_all(int fd, const struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    int retval = writev(fd, iov, iovcnt);
+    if (retval < 0 || (size_t)retval != total) {  // unix socket writes block until done
+        fprintf(stderr, "write error %s\n", strerror(errno));
+        exit(-1);
+    }
+}
+
+void make_input(const Board& board, const Side side, int depth, int visits, input_t& input) {
+    input.black_board = board.get_black_board();
+    input.white_board = board.get_white_board();
+    input.side = side;
+    input.depth = depth;
+    input.player = current_player;
+    input.visits = visits;
+    input.legal_board = board.make_legal_board(side);
+}
+
+// inputs of a request are written directly into shared memory or in-process request if available
+input_t *get_send_data(int slot, inproc_request_t& inproc_request, std::vector<input_t>& send_buffer, int n_position) {
+    if (get_config().transport == TRANSPORT_INPROC) {
+        return inproc_request.inputs;
+    } else if (slot >= 0) {
+        return get_shm_slot(slot).inputs;
+    }
+    send_buffer.resize(n_position);
+    return send_buffer.data();
+}
+
+// send inputs placed by get_send_data() and wait for outputs of the evaluated positions
+void exchange(int server_sock, int slot, inproc_request_t& inproc_request, const request_header_t& send_header, const input_t *send_data,
+              response_header_t& recv_header, std::vector<output_t>& recv_data_all) {
+    int retval;
+    bool inproc = (get_config().transport == TRANSPORT_INPROC);
+    if (inproc) {
+        inproc_request.n_speculative = send_header.n_speculative;
+        submit_request(inproc_request);
+        wait_request(inproc_request);
+        recv_header = inproc_request.header;
+        recv_data_all.assign(inproc_request.outputs, inproc_request.outputs + 1 + recv_header.n_evaluated);
+    } else if (slot >= 0) {
+        shm_slot_t& shm_slot = get_shm_slot(slot);
+        shm_slot.request_header = send_header;
+        post_request(slot);
+        wait_response(slot);
+        recv_header = shm_slot.response_header;
+        recv_data_all.assign(shm_slot.outputs, shm_slot.outputs + 1 + recv_header.n_evaluated);
+        shm_slot.state.store(SHM_IDLE);
+    } else {
+        thread_local std::vector<char> buf;
+        uint8_t flags = (get_config().wire_fp16 ? PROTOCOL_FP16 : 0) | (send_header.priority == PRIORITY_HIGH ? PROTOCOL_HIGH_PRIORITY : 0);
+        encode_request(send_data, 1 + send_header.n_speculative, flags, buf);
+        struct iovec iov[1];
+        iov[0].iov_base = buf.data();
+        iov[0].iov_len = buf.size();
+        write_all(server_sock, iov, 1);
+
+        frame_header_t frame_header;
+        retval = read_all(server_sock, &frame_header, sizeof(frame_header_t));
+        if (retval <= 0){
+            fprintf(stderr, "read error %s\n", (retval < 0) ? strerror(errno) : "disconnected by server");
+            exit(-1);
+        }
+        if (frame_header.version != PROTOCOL_VERSION || frame_header.n_position < 1 || frame_header.n_position > 1 + send_header.n_speculative) {
+            fprintf(stderr, "invalid response (protocol version %d, %d positions)\n", frame_header.version, frame_header.n_position);
+            exit(-1);
+        }
+        buf.resize(response_size(send_data, frame_header.n_position, frame_header.flags));
+        retval = read_all(server_sock, buf.data(), buf.size());
+        if (retval <= 0){
+            fprintf(stderr, "read error %s\n", (retval < 0) ? strerror(errno) : "disconnected by server");
+            exit(-1);
+        }
+        recv_data_all.resize(frame_header.n_position);
+        decode_response(buf.data(), send_data, frame_header.n_position, frame_header.flags, recv_header, recv_data_all.data());
+    }
+}
+
+// address is "host:port" (TCP) or path of unix socket
+bool is_tcp_address(const char *address) {
+    return address[0] != '/' && strchr(address, ':') != NULL;
+}
 
-    int listen_sock = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (listen_sock < 0){
+struct addrinfo *resolve(const char *address, bool passive) {
+    std::string str(address);
+    size_t colon = str.rfind(':');
+    std::string host = str.substr(0, colon);
+    std::string port = str.substr(colon + 1);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    struct addrinfo *info;
+    int retval = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &info);
+    if (retval != 0) {
+        fprintf(stderr, "getaddrinfo error %s (%s)\n", gai_strerror(retval), address);
+        exit(-1);
+    }
+    return info;
+}
+
+void make_unix_addr(const char *path, struct sockaddr_un& addr) {
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "socket path too long \"%s\"\n", path);
+        exit(-1);
+    }
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+}
+
+// requests and responses are small, send them at once (fails harmlessly on unix socket)
+void set_nodelay(int sock) {
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+int listen_at(const char *address) {
+    int listen_sock;
+    int retval = -1;
+    if (is_tcp_address(address)) {
+        struct addrinfo *info = resolve(address, /*passive=*/true);
+        listen_sock = socket(info->ai_family, SOCK_STREAM, 0);
+        if (listen_sock >= 0) {
+            int one = 1;
+            setsockopt(listen_sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            retval = bind(listen_sock, info->ai_addr, info->ai_addrlen);
+        }
+        freeaddrinfo(info);
+    } else {
+        struct sockaddr_un addr;
+        make_unix_addr(address, addr);
+        unlink(address);  // remove old socket file
+        listen_sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_sock >= 0) {
+            retval = bind(listen_sock, (struct sockaddr *)&addr, sizeof(struct sockaddr_un));
+        }
+    }
+    if (listen_sock < 0) {
         fprintf(stderr, "socket error %s\n", strerror(errno));
         exit(-1);
     }
-    if(bind(listen_sock, (struct sockaddr *)&server_addr, sizeof(struct sockaddr_un)) < 0){
-        fprintf(stderr, "bind error %s\n", strerror(errno));
+    if (retval < 0) {
+        fprintf(stderr, "bind error %s (%s)\n", strerror(errno), address);
         exit(-1);
     }
-    if(listen(listen_sock, 128) < 0){
+    if (listen(listen_sock, 128) < 0) {
         fprintf(stderr, "listen error %s\n", strerror(errno));
         exit(-1);
     }
+    return listen_sock;
+}
+
+int connect_to(const char *address) {
+    int sock;
+    int retval = -1;
+    if (is_tcp_address(address)) {
+        struct addrinfo *info = resolve(address, /*passive=*/false);
+        sock = socket(info->ai_family, SOCK_STREAM, 0);
+        if (sock >= 0) {
+            retval = connect(sock, info->ai_addr, info->ai_addrlen);
+            set_nodelay(sock);
+        }
+        freeaddrinfo(info);
+    } else {
+        struct sockaddr_un addr;
+        make_unix_addr(address, addr);
+        sock = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (sock >= 0) {
+            retval = connect(sock, (struct sockaddr *)&addr, sizeof(struct sockaddr_un));
+        }
+    }
+    if (sock < 0) {
+        fprintf(stderr, "socket error %s\n", strerror(errno));
+        exit(-1);
+    }
+    if (retval < 0) {
+        fprintf(stderr, "connect error %s (%s)\n", strerror(errno), address);
+        exit(-1);
+    }
+    return sock;
+}
+
+int connect_to_clients(int pipe_fd, std::vector<int>& client_socks) {
+    const auto& config = get_config();
+
+    int listen_sock = listen_at(socket_path);
 
     int retval = write(pipe_fd, "DONE", 4);  // send done message to parent process
     if (retval < 0){
@@ -49,148 +290,752 @@ int connect_to_clients(int pipe_fd, std::vector<int>& client_socks) {
         exit(-1);
     }
 
+    // wait for the expected clients, later clients are accepted in the event loop
     for (int i = 0; i < config.n_thread; i++) {
-        client_socks[i] = accept(listen_sock, NULL, NULL);
-        if(client_socks[i] < 0){
+        int sock = accept(listen_sock, NULL, NULL);
+        if(sock < 0){
             fprintf(stderr, "accept error %s\n", strerror(errno));
             exit(-1);
         }
+        client_socks.push_back(sock);
     }
     return listen_sock;
 }
 
-void run_server(int pipe_fd) {
-    const auto& config = get_config();
+// shared-memory slot of client (-1 if requests come over socket)
+int read_slot(int sock) {
+    if (get_config().transport != TRANSPORT_SHM) {
+        return -1;
+    }
+    int slot;
+    if (read_all(sock, &slot, sizeof(int)) <= 0) {
+        fprintf(stderr, "read error %s\n", strerror(errno));
+        exit(-1);
+    }
+    return slot;
+}
 
-    printf("server start\n");
-    init_model();
+void add_event(int epoll_fd, int fd, uint32_t id) {
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.u32 = id;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+        fprintf(stderr, "epoll_ctl error %s\n", strerror(errno));
+        exit(-1);
+    }
+}
 
-    std::vector<int> client_socks(config.n_thread);
-    int listen_sock = connect_to_clients(pipe_fd, client_socks);
-    // printf("accepted %d clients\n", config.n_thread);
+// wake up epoll_wait after usec (0: disarm)
+void set_timer(int timer_fd, long usec) {
+    struct itimerspec spec;
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = usec / 1000000;
+    spec.it_value.tv_nsec = (usec % 1000000) * 1000;
+    if (timerfd_settime(timer_fd, 0, &spec, NULL) < 0) {
+        fprintf(stderr, "timerfd_settime error %s\n", strerror(errno));
+        exit(-1);
+    }
+}
 
-    // initialization for select()
-    int maxfd = 0;
-    fd_set fds_org;
-    FD_ZERO(&fds_org);
-    for (int i = 0; i < config.n_thread; i++) {
-        FD_SET(client_socks[i], &fds_org);
-        maxfd = std::max(client_socks[i], maxfd);
+typedef struct {
+    int sock;  // -1 if disconnected
+    int slot;  // shared-memory slot (-1: requests over socket)
+    std::atomic<bool> pending;  // request is in a batch (cleared by worker after reply)
+    std::vector<input_t> data;  // buffer of socket requests
+    std::vector<char> frame;  // request frame being received
+    size_t n_received;  // bytes of frame received so far
+    uint8_t flags;  // protocol flags of the last socket request (used for its response)
+    int priority;  // class of the last request
+    const input_t *inputs;  // main input followed by speculative inputs of the last request
+    int n_speculative;
+    bool watched;  // socket is in epoll set (only used by I/O thread)
+} client_t;
+
+// after disconnection and reply to its last request
+void close_client(client_t& client) {
+    close(client.sock);
+    client.sock = -1;
+    if (client.slot >= 0) {
+        release_shm_slot(client.slot);
     }
+}
 
-    int retval;
-    int n_disc = 0;
-
-    input_t *recv_data = new input_t[config.n_thread];
-    output_t *send_data = new output_t[config.n_thread];
-
-    // static int total_count = 0;  // total count of inference
-    // std::chrono::system_clock::time_point start, end;
-    // float elapsed;  // msec
-    // float work_time = 1.0;  // msec
-    // float occupancy_rate;
-
-    while (true) {  // loop until all clients disconnect
-        std::vector<int> to_respond;
-        int n_recv = 0;
-        int timeout_count = 0;
-
-        // receive data
-        while (n_recv + n_disc < config.n_thread && timeout_count < MAX_TIMEOUT) {
-            fd_set fds = fds_org;
-            if (n_recv == 0) {    // no waiting client
-                retval = select(maxfd+1, &fds, NULL, NULL, NULL);
-            } else {
-                struct timeval tv;
-                tv.tv_sec = 0;
-                tv.tv_usec = TIMEOUT_USEC;  // TODO: better way?
-                retval = select(maxfd+1, &fds, NULL, NULL, &tv);
-                timeout_count += 1;
+void init_client(client_t& client, int sock) {
+    client.sock = sock;
+    client.slot = read_slot(sock);
+    client.pending = false;
+    client.n_received = 0;
+    client.inputs = nullptr;
+    client.n_speculative = 0;
+    client.flags = 0;
+    client.priority = PRIORITY_LOW;
+    client.watched = true;  // added to epoll set by caller
+}
+
+// socket clients are not read while their request is in a batch, so that fields used by replier stay unchanged
+void watch_client(int epoll_fd, client_t& client, uint32_t id, bool watch) {
+    if (client.watched == watch) {
+        return;
+    }
+    if (watch) {
+        add_event(epoll_fd, client.sock, id);
+    } else if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client.sock, NULL) < 0) {
+        fprintf(stderr, "epoll_ctl error %s\n", strerror(errno));
+        exit(-1);
+    }
+    client.watched = watch;
+}
+
+// receive what has arrived of the request frame without blocking the I/O thread (complete is set once the whole frame is in),
+// return false if disconnected (with shared memory, socket only reports disconnection)
+bool read_request(client_t& client, bool& complete) {
+    complete = false;
+    frame_header_t header;
+    while (true) {
+        size_t frame_size = sizeof(frame_header_t);
+        if (client.n_received >= sizeof(frame_header_t)) {
+            memcpy(&header, client.frame.data(), sizeof(frame_header_t));
+            frame_size += sizeof(wire_input_t) * header.n_position;
+            if (client.n_received == frame_size) {
+                break;
+            }
+        }
+        client.frame.resize(frame_size);
+        int retval = recv(client.sock, client.frame.data() + client.n_received, frame_size - client.n_received, MSG_DONTWAIT);
+        if (retval < 0 && errno == EINTR) {
+            continue;
+        }
+        if (retval < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {  // rest of the frame is read at the next event
+            return true;
+        }
+        if (retval < 0 && errno != ECONNRESET) {  // reset by remote client is a disconnection
+            fprintf(stderr, "read error %s\n", strerror(errno));
+            exit(-1);
+        }
+        if (retval <= 0) {
+            return false;
+        }
+        assert(client.slot < 0);
+        client.n_received += retval;
+        if (client.n_received == sizeof(frame_header_t)) {
+            memcpy(&header, client.frame.data(), sizeof(frame_header_t));
+            if (header.version != PROTOCOL_VERSION || header.n_position < 1 || header.n_position > 1 + MAX_SPECULATIVE) {
+                fprintf(stderr, "invalid request (protocol version %d, %d positions), disconnect client\n", header.version, header.n_position);
+                return false;
             }
+        }
+    }
+    client.n_received = 0;
 
-            if (retval < 0) {
-                fprintf(stderr, "select error %s\n", strerror(errno));
-                exit(-1);
-            } else if (retval == 0) {
-                // fprintf(stdout, "timeout (timeout_count = %d, n_recv = %d)\n", timeout_count, n_recv);
+    const wire_input_t *wire_inputs = reinterpret_cast<const wire_input_t*>(client.frame.data() + sizeof(frame_header_t));  // packed
+    int n_player = get_config().n_player;
+    for (int k = 0; k < header.n_position; k++) {  // player selects the model
+        if (wire_inputs[k].side > 1 || wire_inputs[k].player >= n_player) {
+            fprintf(stderr, "invalid request (side %d, player %d), disconnect client\n", wire_inputs[k].side, wire_inputs[k].player);
+            return false;
+        }
+    }
+    client.data.resize(header.n_position);
+    decode_inputs(wire_inputs, header.n_position, client.data.data());
+    client.inputs = client.data.data();
+    client.n_speculative = header.n_position - 1;
+    client.flags = header.flags;
+    client.priority = (header.flags & PROTOCOL_HIGH_PRIORITY) ? PRIORITY_HIGH : PRIORITY_LOW;
+    complete = true;
+    return true;
+}
+
+// rows of a batch requests of the class may fill (the others are reserved for high priority)
+int batch_capacity(int priority, int batch_size, int reserved_rows) {
+    return (priority == PRIORITY_HIGH) ? batch_size : batch_size - reserved_rows;
+}
+
+// take requests posted in shared memory, return false if none
+bool poll_slots(std::deque<client_t>& clients, std::vector<int>& to_respond, int batch_size, int reserved_rows) {
+    bool found = false;
+    for (unsigned int i = 0; i < clients.size() && (int)to_respond.size() < batch_size; i++) {
+        client_t& client = clients[i];
+        if (client.slot < 0 || client.sock < 0 || client.pending) {
+            continue;
+        }
+        shm_slot_t& slot = get_shm_slot(client.slot);
+        if (slot.state.load() == SHM_REQUEST) {
+            assert(slot.request_header.n_speculative >= 0 && slot.request_header.n_speculative <= MAX_SPECULATIVE);
+            int priority = (slot.request_header.priority == PRIORITY_HIGH) ? PRIORITY_HIGH : PRIORITY_LOW;
+            if ((int)to_respond.size() >= batch_capacity(priority, batch_size, reserved_rows)) {
                 continue;
             }
+            client.priority = priority;
+            client.inputs = slot.inputs;  // read directly into batch later
+            client.n_speculative = slot.request_header.n_speculative;
+            client.pending = true;
+            to_respond.push_back(i);
+            found = true;
+        }
+    }
+    return found;
+}
+
+void send_response(client_t& client, const response_header_t& header, const output_t *outputs) {
+    if (client.slot >= 0) {
+        shm_slot_t& slot = get_shm_slot(client.slot);
+        slot.response_header = header;
+        std::copy(outputs, outputs + 1 + header.n_evaluated, slot.outputs);
+        post_response(client.slot);
+        return;
+    }
+    thread_local std::vector<char> buf;
+    encode_response(header, client.inputs, outputs, client.flags, buf);
+    struct iovec iov[1];
+    iov[0].iov_base = buf.data();
+    iov[0].iov_len = buf.size();
+    if (writev(client.sock, iov, 1) < 0 && errno != EPIPE && errno != ECONNRESET) {  // disconnection is handled by I/O thread
+        fprintf(stderr, "write error %s\n", strerror(errno));
+        exit(-1);
+    }
+}
 
-            for (int i = 0; i < config.n_thread; i++) {
-                if (FD_ISSET(client_socks[i], &fds)) {
-                    char buf[100];
-                    memset(buf, 0, sizeof(buf));
-                    retval = read(client_socks[i], &recv_data[i], sizeof(input_t));
+// batch closed by I/O thread and evaluated by one of inference workers
+typedef struct {
+    std::vector<client_t*> clients;  // client of k-th request (workers do not index the deque of clients)
+    std::vector<int> priorities;  // class of k-th request
+    std::vector<std::chrono::steady_clock::time_point> arrivals;  // of k-th request
+    std::vector<batch_request_t> requests;
+    std::vector<output_t> outputs;  // 1 + MAX_SPECULATIVE outputs per request
+    batch_plan_t plan;
+    bool urgent;  // has a high-priority request (overtakes other batches waiting in queues)
+} server_batch_t;
 
-                    if (retval < 0) {
-                        fprintf(stderr, "read error %s\n", strerror(errno));
-                        exit(-1);
-                    } else if (retval == 0) {
-                        // fprintf(stdout, "disconnected by client %d\n", i);
-                        FD_CLR(client_socks[i], &fds_org);  // stop monitoring this client
-                        n_disc += 1;
-                        continue;
-                    }
+// stages of the pipeline (receive: I/O thread, others: threads of each worker)
+#define STAGE_RECEIVE 0
+#define STAGE_STAGE 1
+#define STAGE_FORWARD 2
+#define STAGE_REPLY 3
+#define N_STAGE 4
+const char *STAGE_NAMES[N_STAGE] = {"receive", "stage", "forward", "reply"};
 
-                    to_respond.push_back(i);  // exclude disconnection
-                    n_recv += 1;  // include disconnection
-                    // fprintf(stdout, "receive %d from client %d\n", recv_data[i].num_i, i);
-                }
-                // else {
-                //     // fprintf(stdout, "no data from client %d\n", i);
-                // }
+// shared by I/O thread and inference workers
+std::mutex batch_mutex;
+std::condition_variable batch_cv;
+std::deque<server_batch_t*> batch_queue;
+bool closing = false;  // no more batches
+float forward_usec = 0.0;  // moving average of the time of inference per batch
+std::atomic<int> n_free_buffer(0);  // staging buffers not used by any batch
+std::atomic<int> n_in_flight(0);  // requests handed to workers and not yet answered
+std::atomic<long> busy_usec[N_STAGE];  // time spent in each stage (summed over threads)
+int worker_event_fd;  // wakes up I/O thread when a buffer gets free or replies are sent
+
+// batches move stage -> forward -> reply in threads of a worker,
+// so batch k+1 is staged and batch k-1 is replied while batch k runs
+typedef struct {
+    std::mutex mutex;
+    std::condition_variable cv;
+    bool buffer_busy[N_STAGING];
+    std::deque<server_batch_t*> staged;  // waiting for forward
+    std::deque<server_batch_t*> forwarded;  // waiting for reply
+    bool stage_done;
+    bool forward_done;
+} pipeline_t;
+
+long elapsed_usec(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+void wake_io_thread() {
+    uint64_t one = 1;
+    if (write(worker_event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "write error %s\n", strerror(errno));
+        exit(-1);
+    }
+}
+
+void run_stager(int worker_id, pipeline_t& pipeline) {
+    bind_worker(worker_id);
+
+    while (true) {
+        int buffer_id;
+        {  // urgent batches are forwarded out of order, so buffers get free in any order
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            auto free_buffer = [&] { return std::find(std::begin(pipeline.buffer_busy), std::end(pipeline.buffer_busy), false); };
+            pipeline.cv.wait(lock, [&] { return free_buffer() != std::end(pipeline.buffer_busy); });
+            buffer_id = free_buffer() - std::begin(pipeline.buffer_busy);
+        }
+        server_batch_t *batch;
+        {  // take a batch only when a buffer is free, so that another worker gets it otherwise
+            std::unique_lock<std::mutex> lock(batch_mutex);
+            batch_cv.wait(lock, [] { return !batch_queue.empty() || closing; });
+            if (batch_queue.empty()) {  // closing
+                break;
             }
-            // printf("timeout_count = %d, n_recv = %d\n", timeout_count, n_recv);
+            batch = batch_queue.front();
+            batch_queue.pop_front();
         }
 
-        if (n_disc == config.n_thread) {  // all clients disconnected
-            break;
+        auto start = std::chrono::steady_clock::now();
+        stage_batch(batch->requests.data(), batch->requests.size(), buffer_id, batch->plan);
+        long elapsed = elapsed_usec(start);
+        busy_usec[STAGE_STAGE] += elapsed;
+        observe_stage(elapsed);
+
+        std::lock_guard<std::mutex> lock(pipeline.mutex);
+        pipeline.buffer_busy[buffer_id] = true;
+        pipeline.staged.push_back(batch);
+        pipeline.cv.notify_all();
+    }
+
+    std::lock_guard<std::mutex> lock(pipeline.mutex);
+    pipeline.stage_done = true;
+    pipeline.cv.notify_all();
+}
+
+void run_forwarder(int worker_id, pipeline_t& pipeline) {
+    bind_worker(worker_id);
+
+    while (true) {
+        server_batch_t *batch;
+        {
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            pipeline.cv.wait(lock, [&] { return !pipeline.staged.empty() || pipeline.stage_done; });
+            if (pipeline.staged.empty()) {
+                break;
+            }
+            auto it = std::find_if(pipeline.staged.begin(), pipeline.staged.end(), [](const server_batch_t *b) { return b->urgent; });
+            if (it == pipeline.staged.end()) {
+                it = pipeline.staged.begin();
+            }
+            batch = *it;
+            pipeline.staged.erase(it);
         }
 
-        // total_count += 1;
+        float elapsed = forward_batch(batch->plan);
+        busy_usec[STAGE_FORWARD] += elapsed;
+        int n_row = std::accumulate(batch->plan.n_row.begin(), batch->plan.n_row.end(), 0);
+        observe_forward(n_row, batch->plan.n_free, elapsed);
+        {
+            std::lock_guard<std::mutex> lock(batch_mutex);
+            forward_usec = (forward_usec == 0.0) ? elapsed : forward_usec * 0.9 + elapsed * 0.1;
+        }
+        {
+            std::lock_guard<std::mutex> lock(pipeline.mutex);
+            pipeline.buffer_busy[batch->plan.buffer_id] = false;
+            pipeline.forwarded.push_back(batch);
+            pipeline.cv.notify_all();
+        }
+        n_free_buffer++;
+        wake_io_thread();
+    }
+
+    std::lock_guard<std::mutex> lock(pipeline.mutex);
+    pipeline.forward_done = true;
+    pipeline.cv.notify_all();
+}
+
+void run_replier(pipeline_t& pipeline) {
+    while (true) {
+        server_batch_t *batch;
+        {
+            std::unique_lock<std::mutex> lock(pipeline.mutex);
+            pipeline.cv.wait(lock, [&] { return !pipeline.forwarded.empty() || pipeline.forward_done; });
+            if (pipeline.forwarded.empty()) {
+                break;
+            }
+            batch = pipeline.forwarded.front();
+            pipeline.forwarded.pop_front();
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        int n_request = batch->requests.size();
+        finish_batch(batch->requests.data(), n_request, batch->plan);
+        for (int k = 0; k < n_request; k++) {
+            client_t& client = *batch->clients[k];
+            send_response(client, batch->requests[k].header, batch->requests[k].outputs);
+            observe_latency(batch->priorities[k], elapsed_usec(batch->arrivals[k]));
+            client.pending = false;  // after reply, or the old request in shared memory would be taken again
+        }
+        n_in_flight -= n_request;
+        delete batch;
+        long elapsed = elapsed_usec(start);
+        busy_usec[STAGE_REPLY] += elapsed;
+        observe_reply(elapsed);
+        wake_io_thread();  // shared-memory requests of replied clients may be waiting
+    }
+}
+
+void dispatch(std::deque<client_t>& clients, const std::vector<int>& to_respond, const std::vector<std::chrono::steady_clock::time_point>& arrivals, bool urgent) {
+    server_batch_t *batch = new server_batch_t;
+    int n_request = to_respond.size();
+    observe_batch(n_request);
+    for (int k = 0; k < n_request; k++) {
+        observe_request_wait(clients[to_respond[k]].priority, elapsed_usec(arrivals[k]));
+    }
+    batch->arrivals = arrivals;
+    batch->urgent = urgent;
+    batch->requests.resize(n_request);
+    batch->outputs.resize(n_request * (1 + MAX_SPECULATIVE));
+    for (int k = 0; k < n_request; k++) {
+        client_t& client = clients[to_respond[k]];
+        batch->clients.push_back(&client);
+        batch->priorities.push_back(client.priority);
+        batch->requests[k].inputs = client.inputs;
+        batch->requests[k].n_speculative = client.n_speculative;
+        batch->requests[k].outputs = &batch->outputs[k * (1 + MAX_SPECULATIVE)];
+    }
+    n_in_flight += n_request;
+    n_free_buffer--;
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex);
+        if (urgent) {
+            batch_queue.push_front(batch);
+        } else {
+            batch_queue.push_back(batch);
+        }
+    }
+    batch_cv.notify_all();
+}
+
+// Prometheus text endpoint (minimal HTTP server answering every request with all metrics, one request per connection)
+void serve_metrics(int listen_sock) {
+    while (true) {
+        int sock = accept(listen_sock, NULL, NULL);
+        if (sock < 0) {
+            fprintf(stderr, "accept error %s\n", strerror(errno));
+            continue;
+        }
+        struct timeval timeout = {METRICS_TIMEOUT_SEC, 0};
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        char request_buf[4096];
+        if (read(sock, request_buf, sizeof(request_buf)) < 0) {  // request itself is ignored
+            close(sock);
+            continue;
+        }
+        std::string body = format_metrics();
+        std::string header = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n";
+        struct iovec iov[2];
+        iov[0].iov_base = const_cast<char*>(header.data());
+        iov[0].iov_len = header.size();
+        iov[1].iov_base = const_cast<char*>(body.data());
+        iov[1].iov_len = body.size();
+        if (writev(sock, iov, 2) < 0) {
+            fprintf(stderr, "write error %s\n", strerror(errno));
+        }
+        close(sock);
+    }
+}
+
+void dump_metrics(const char *fname, int interval_sec) {
+    while (true) {
+        std::this_thread::sleep_for(std::chrono::seconds(interval_sec));
+        write_metrics_file(fname);
+    }
+}
+
+// fraction of time each stage is busy (1.0 = all threads of the stage always busy)
+void print_occupancy(std::chrono::steady_clock::time_point start, long n_batch) {
+    const auto& config = get_config();
+
+    float wall_usec = std::max(elapsed_usec(start), 1L);
+    printf("batches=%ld occupancy:", n_batch);
+    for (int i = 0; i < N_STAGE; i++) {
+        int n_stage_thread = (i == STAGE_RECEIVE) ? 1 : config.n_worker;
+        printf(" %s=%.3f", STAGE_NAMES[i], busy_usec[i] / (wall_usec * n_stage_thread));
+    }
+    printf("\n%s\n%s\n", format_batch_summary().c_str(), format_latency_summary().c_str());
+    fflush(stdout);
+}
+
+// I/O thread receives requests and closes batches while workers run inference
+// (returns when all clients are disconnected unless persistent)
+void serve_clients(int listen_sock, const std::vector<int>& client_socks, bool persistent) {
+    const auto& config = get_config();
+
+    signal(SIGPIPE, SIG_IGN);  // replies to a disconnected client fail with EPIPE instead
+
+    init_metrics(config.n_thread);
+    if (config.metrics_address[0] != '\0') {
+        int metrics_sock = listen_at(config.metrics_address);
+        printf("metrics at %s\n", config.metrics_address);
+        std::thread(serve_metrics, metrics_sock).detach();
+    }
+    if (config.metrics_fname[0] != '\0') {
+        std::thread(dump_metrics, config.metrics_fname, std::max(config.metrics_interval_sec, 1)).detach();
+    }
+
+    // event ids of epoll (other ids are client indices)
+    const uint32_t LISTEN_ID = UINT32_MAX;
+    const uint32_t TIMER_ID = UINT32_MAX - 1;
+    const uint32_t SHM_ID = UINT32_MAX - 2;
+    const uint32_t WORKER_ID = UINT32_MAX - 3;
+    bool use_shm = (config.transport == TRANSPORT_SHM);
+
+    int epoll_fd = epoll_create1(0);
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    worker_event_fd = eventfd(0, EFD_NONBLOCK);
+    if (epoll_fd < 0 || timer_fd < 0 || worker_event_fd < 0) {
+        fprintf(stderr, "epoll error %s\n", strerror(errno));
+        exit(-1);
+    }
+    add_event(epoll_fd, listen_sock, LISTEN_ID);
+    add_event(epoll_fd, timer_fd, TIMER_ID);
+    add_event(epoll_fd, worker_event_fd, WORKER_ID);
+    if (use_shm) {
+        add_event(epoll_fd, get_shm_event_fd(), SHM_ID);
+    }
+
+    std::deque<client_t> clients;  // only indexed by I/O thread, workers keep pointers while new clients are added
+    for (int sock : client_socks) {
+        add_event(epoll_fd, sock, clients.size());
+        clients.emplace_back();
+        init_client(clients.back(), sock);
+    }
+    int n_connected = clients.size();
+    std::vector<int> closing_clients;  // disconnected while a request is in a batch (closed after reply)
+    std::vector<int> free_clients;  // entries of closed clients, reused for new connections
+    std::vector<int> replying_clients;  // socket clients with a request in a batch (watched again after reply)
+    std::vector<int> deferred_clients;  // socket clients left for the next batch (watched again when it opens)
+    std::vector<struct epoll_event> events(64);
 
-        // start = std::chrono::system_clock::now();
-        inference(recv_data, send_data);
+    n_free_buffer = config.n_worker * N_STAGING;
+    for (int i = 0; i < N_STAGE; i++) {
+        busy_usec[i] = 0;
+    }
+    std::vector<pipeline_t> pipelines(config.n_worker);
+    std::vector<std::thread> workers;
+    for (int i = 0; i < config.n_worker; i++) {
+        std::fill(std::begin(pipelines[i].buffer_busy), std::end(pipelines[i].buffer_busy), false);
+        pipelines[i].stage_done = false;
+        pipelines[i].forward_done = false;
+        workers.emplace_back(run_stager, i, std::ref(pipelines[i]));
+        workers.emplace_back(run_forwarder, i, std::ref(pipelines[i]));
+        workers.emplace_back(run_replier, std::ref(pipelines[i]));
+    }
+    auto server_start = std::chrono::steady_clock::now();
+    long n_batch = 0;
+
+    int batch_size = config.n_thread;  // max rows of a batch
+    int reserved_rows = std::max(0, std::min(config.reserved_rows, batch_size - 1));
+    int reserved_buffers = std::max(0, std::min(config.reserved_buffers, config.n_worker * N_STAGING - 1));
+    float arrival_usec = 0.0;  // moving average of the interval of requests in a batch
+
+    while (n_connected > 0 || persistent) {  // loop until all clients disconnect
+        std::vector<int> to_respond;  // client index of k-th request (its main input uses row k)
+        std::vector<std::chrono::steady_clock::time_point> arrivals;  // of k-th request
+        auto first_arrival = std::chrono::steady_clock::now();
+        auto last_arrival = first_arrival;
+        bool ready = false;
+        bool urgent = false;  // a high-priority request is in the batch
+        // level-triggered epoll would report unread sockets again and again while the batch is full
+        for (int id : deferred_clients) {
+            watch_client(epoll_fd, clients[id], id, true);
+        }
+        deferred_clients.clear();
 
-        // send data
-        for (int idx : to_respond) {
-            retval = write(client_socks[idx], &send_data[idx], sizeof(output_t));
-            if (retval < 0){
-                fprintf(stderr, "write error %s\n", strerror(errno));
+        // receive data until the batch is full, every client is waiting or the wait budget is spent
+        // (a batch that is not full is kept open while all staging buffers are used)
+        while (!ready && (n_connected > 0 || persistent)) {
+            unsigned int n_before = to_respond.size();
+            for (auto it = replying_clients.begin(); it != replying_clients.end();) {
+                if (clients[*it].pending) {
+                    ++it;
+                    continue;
+                }
+                watch_client(epoll_fd, clients[*it], *it, true);
+                it = replying_clients.erase(it);
+            }
+            bool polled = false;
+            if (use_shm) {  // sleep only if no request is posted after announcing it
+                polled = poll_slots(clients, to_respond, batch_size, reserved_rows);
+                if (!polled) {
+                    set_server_waiting(true);
+                    polled = poll_slots(clients, to_respond, batch_size, reserved_rows);
+                }
+            }
+            int n_event = epoll_wait(epoll_fd, events.data(), events.size(), polled ? 0 : -1);
+            auto receive_start = std::chrono::steady_clock::now();
+            if (use_shm) {
+                set_server_waiting(false);
+            }
+            if (n_event < 0 && errno == EINTR) {
+                n_event = 0;
+            } else if (n_event < 0) {
+                fprintf(stderr, "epoll_wait error %s\n", strerror(errno));
                 exit(-1);
             }
+
+            for (int e = 0; e < n_event; e++) {
+                uint32_t id = events[e].data.u32;
+                if (id == LISTEN_ID) {
+                    int sock = accept(listen_sock, NULL, NULL);
+                    if (sock < 0) {
+                        fprintf(stderr, "accept error %s\n", strerror(errno));
+                        exit(-1);
+                    }
+                    set_nodelay(sock);
+                    int new_id = clients.size();
+                    if (!free_clients.empty()) {  // events of the closed socket were removed at disconnection
+                        new_id = free_clients.back();
+                        free_clients.pop_back();
+                    } else {
+                        clients.emplace_back();
+                    }
+                    add_event(epoll_fd, sock, new_id);
+                    init_client(clients[new_id], sock);
+                    n_connected += 1;
+                } else if (id == TIMER_ID || id == SHM_ID || id == WORKER_ID) {
+                    int fd = (id == TIMER_ID) ? timer_fd : (id == SHM_ID) ? get_shm_event_fd() : worker_event_fd;
+                    uint64_t count;
+                    while (read(fd, &count, sizeof(count)) > 0) {}  // only wakes up the loop
+                } else if ((int)to_respond.size() < batch_capacity(clients[id].priority, batch_size, reserved_rows) || clients[id].slot >= 0) {  // otherwise left for the next batch
+                    // class of the previous request of the client decides, a request of another class still fits in batch_size
+                    client_t& client = clients[id];
+                    bool complete;
+                    if (!read_request(client, complete)) {
+                        // fprintf(stdout, "disconnected by client %d\n", id);
+                        watch_client(epoll_fd, client, id, false);
+                        if (client.pending) {  // replier still uses the socket
+                            closing_clients.push_back(id);
+                        } else {
+                            close_client(client);
+                            free_clients.push_back(id);
+                        }
+                        n_connected -= 1;
+                        continue;
+                    }
+                    if (!complete) {
+                        continue;
+                    }
+                    client.pending = true;
+                    to_respond.push_back(id);
+                    if (client.slot < 0) {  // next request is read after reply
+                        watch_client(epoll_fd, client, id, false);
+                        replying_clients.push_back(id);
+                    }
+                } else {
+                    watch_client(epoll_fd, clients[id], id, false);
+                    deferred_clients.push_back(id);
+                }
+            }
+
+            for (unsigned int k = n_before; k < to_respond.size(); k++) {
+                auto now = std::chrono::steady_clock::now();
+                if (k == 0) {
+                    first_arrival = now;
+                } else {
+                    float interval = std::chrono::duration_cast<std::chrono::microseconds>(now - last_arrival).count();
+                    arrival_usec = arrival_usec * 0.9 + interval * 0.1;
+                }
+                last_arrival = now;
+                arrivals.push_back(now);
+                urgent = urgent || (clients[to_respond[k]].priority == PRIORITY_HIGH);
+            }
+
+            for (auto it = closing_clients.begin(); it != closing_clients.end();) {
+                client_t& client = clients[*it];
+                if (client.pending) {
+                    ++it;
+                    continue;
+                }
+                close_client(client);
+                free_clients.push_back(*it);
+                it = closing_clients.erase(it);
+            }
+
+            set_connected_clients(n_connected);
+            busy_usec[STAGE_RECEIVE] += elapsed_usec(receive_start);
+            if (to_respond.empty()) {
+                continue;
+            }
+            // clients with a request in a batch are blocked until reply
+            // (requests of disconnected clients are still in flight until their reply)
+            int n_orphan = std::count_if(closing_clients.begin(), closing_clients.end(), [&](int id) {
+                return clients[id].pending && std::find(to_respond.begin(), to_respond.end(), id) == to_respond.end();
+            });
+            int n_expected = std::max(1, std::min(batch_size, n_connected - (n_in_flight.load() - n_orphan)));
+            long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - first_arrival).count();
+            long remaining;
+            {
+                std::lock_guard<std::mutex> lock(batch_mutex);
+                remaining = batch_wait_usec(to_respond.size(), n_expected, forward_usec) - elapsed;
+            }
+            // high-priority request does not wait for more requests, reserved rows are kept open while buffers are busy
+            // (with reserved buffers, bulk batches are not staged ahead so that an urgent batch runs next)
+            if ((int)to_respond.size() >= batch_size) {
+                ready = true;
+            } else if (urgent || (int)to_respond.size() >= batch_size - reserved_rows || (int)to_respond.size() >= n_expected || remaining <= 0 || remaining < arrival_usec) {
+                ready = (n_free_buffer.load() > (urgent ? 0 : reserved_buffers));  // otherwise woken up by worker
+                set_timer(timer_fd, 0);
+            } else {
+                set_timer(timer_fd, remaining);
+            }
         }
+        set_timer(timer_fd, 0);
 
-        // if (total_count % 1000 == 0) {
-            // end = std::chrono::system_clock::now();
-            // elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() * 1e-3;
-            // occupancy_rate = (float)n_recv / config.n_thread;
-            // printf("%d: occupancy_rate=%.3f\n", total_count, occupancy_rate);
-            // work_time = work_time * 0.99 + elapsed * 0.01;
-            // printf("work_time=%.3f\n", work_time)
-        // }
+        if (to_respond.empty()) {  // all clients disconnected
+            break;
+        }
+        dispatch(clients, to_respond, arrivals, urgent);
+        if (++n_batch % 100000 == 0) {
+            print_occupancy(server_start, n_batch);
+        }
     }
 
-    delete[] recv_data;
-    delete[] send_data;
+    {
+        std::lock_guard<std::mutex> lock(batch_mutex);
+        closing = true;
+    }
+    batch_cv.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    print_occupancy(server_start, n_batch);
+    if (config.metrics_fname[0] != '\0') {
+        write_metrics_file(config.metrics_fname);
+    }
 
-    for (int i = 0; i < config.n_thread; i++) {
-        close(client_socks[i]);
+    for (int id : closing_clients) {
+        close(clients[id].sock);
     }
+    close(worker_event_fd);
+    close(timer_fd);
+    close(epoll_fd);
     close(listen_sock);
 }
 
+// server process forked by create_server_process()
+void run_server(int pipe_fd) {
+    const auto& config = get_config();
+
+    printf("server start (pid %d, send SIGHUP to reload models)\n", getpid());
+    init_model(config.n_worker);
+
+    std::vector<int> client_socks;
+    int listen_sock = connect_to_clients(pipe_fd, client_socks);
+    // printf("accepted %d clients\n", config.n_thread);
+    serve_clients(listen_sock, client_socks, /*persistent=*/false);
+}
+
 }  // namespace
 
 
 pid_t create_server_process() {
+    if (get_config().evaluator == EVALUATOR_HEURISTIC) {  // no server needed
+        return 0;
+    }
+    if (get_config().transport == TRANSPORT_INPROC) {  // inference thread instead of server process
+        start_inference_thread();
+        return 0;
+    }
+
+    if (get_config().server_address[0] != '\0') {  // connect to server started elsewhere
+        return 0;
+    }
+
     // define socket file name
     sprintf(socket_path, "/tmp/server_%d.sock", getpid());
-    unlink(socket_path);  // remove old socket file
-    // set server address
-    memset(&server_addr, 0, sizeof(struct sockaddr_un));
-    server_addr.sun_family = AF_UNIX;
-    strcpy(server_addr.sun_path, socket_path);
+
+    if (get_config().transport == TRANSPORT_SHM && !shm_created()) {  // shared by server and clients
+        create_shm(get_config().n_thread + SHM_SPARE_SLOTS);
+    }
 
     // create pipe to receive sign of preparation completion
     int pipe_c2p[2];
@@ -218,8 +1063,8 @@ pid_t create_server_process() {
         fprintf(stderr, "read error %s\n", strerror(errno));
         exit(-1);
     }
-    if (strcmp(buf, "DONE") != 0) {
-        fprintf(stderr, "message error \"%s\" != \"DONE\"\n", buf);
+    if (strncmp(buf, "DONE", 4) != 0) {  // buf is not null-terminated
+        fprintf(stderr, "message error \"%.4s\" != \"DONE\"\n", buf);
     }
     // printf("received \"%s\" from server\n", buf);
     close(pipe_c2p[0]);
@@ -229,44 +1074,118 @@ pid_t create_server_process() {
 }
 
 int connect_to_server() {
-    int server_sock = socket(AF_UNIX, SOCK_STREAM, 0);
-    if (server_sock < 0){
-        fprintf(stderr, "socket error %s\n", strerror(errno));
-        exit(-1);
+    if (get_config().evaluator == EVALUATOR_HEURISTIC) {
+        return -1;
     }
-    if (connect(server_sock, (struct sockaddr *)&server_addr, sizeof(struct sockaddr_un)) < 0){
-        fprintf(stderr, "connect error %s\n", strerror(errno));
-        exit(-1);
+    if (get_config().transport == TRANSPORT_INPROC) {
+        add_inproc_client();
+        return -1;
+    }
+
+    const char *server_address = get_config().server_address;
+    int server_sock = connect_to((server_address[0] != '\0') ? server_address : socket_path);
+
+    if (get_config().transport == TRANSPORT_SHM) {  // tell server which slot this connection uses
+        int slot = acquire_shm_slot();  // if no slot is left, requests go over socket
+        struct iovec iov[1];
+        iov[0].iov_base = &slot;
+        iov[0].iov_len = sizeof(int);
+        write_all(server_sock, iov, 1);
+        std::lock_guard<std::mutex> lock(slot_mutex);
+        sock_slots[server_sock] = slot;
+        slot_generation++;
     }
     return server_sock;
 }
 
+// inference server of a separate process, clients join and leave at any time (runs until killed)
+void run_standalone_server(const char *address) {
+    const auto& config = get_config();
+
+    printf("server start (pid %d, send SIGHUP to reload models)\n", getpid());
+    init_model(config.n_worker);
+
+    int listen_sock = listen_at(address);
+    printf("listening at %s\n", address);
+    fflush(stdout);
+    serve_clients(listen_sock, {}, /*persistent=*/true);
+}
+
+void disconnect_from_server(int server_sock) {
+    if (get_config().evaluator == EVALUATOR_HEURISTIC) {
+        return;
+    }
+    if (get_config().transport == TRANSPORT_INPROC) {
+        remove_inproc_client();
+        return;
+    }
+    {  // slot is released by server when it sees the disconnection
+        std::lock_guard<std::mutex> lock(slot_mutex);
+        sock_slots.erase(server_sock);
+    }
+    close(server_sock);
+}
 
-void request(int server_sock, const Board& board, const Side side, const std::vector<bool>& legal_flags, std::vector<float>& priors, float& value) {
+
+void request(int server_sock, const Board& board, const Side side, const std::vector<bool>& legal_flags, std::vector<float>& priors, float& value, int depth, int visits) {
     // thread_local int call_count = 0;
     // thread_local float wait_time = 1.0;  // msec
 
-    int retval;
-    input_t send_data;
-    send_data.black_board = board.get_black_board();
-    send_data.white_board = board.get_white_board();
-    send_data.side = side;
-    std::copy(legal_flags.begin(), legal_flags.end(), std::begin(send_data.legal_flags));
+    if (get_config().evaluator == EVALUATOR_HEURISTIC) {
+        evaluate_heuristic(board, side, legal_flags, priors, value);
+        n_evaluation.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
 
-    // auto start = std::chrono::system_clock::now();
-    retval = write(server_sock, &send_data, sizeof(input_t));
-    if (retval < 0){
-        fprintf(stderr, "write error %s\n", strerror(errno));
-        exit(-1);
+    // evaluated in advance with spare batch capacity (by the model this request is routed to)
+    bool small = (current_player == 0 && use_small_model(depth, visits));
+    auto it = eval_cache.find(std::make_tuple(board.get_black_board(), board.get_white_board(), side, current_player, small));
+    if (it != eval_cache.end()) {
+        std::copy(std::begin(it->second.priors), std::end(it->second.priors), priors.begin());
+        value = it->second.value;
+        eval_cache.erase(it);
+        return;
     }
 
-    output_t recv_data;
-    retval = read(server_sock, &recv_data, sizeof(output_t));
-    if (retval < 0){
-        fprintf(stderr, "read error %s\n", strerror(errno));
-        exit(-1);
+    int slot = get_slot(server_sock);
+    inproc_request_t inproc_request;
+    request_header_t send_header;
+    send_header.n_speculative = std::min((int)speculative_inputs.size(), get_speculative_capacity());
+    send_header.priority = get_config().priority;
+    std::vector<input_t> send_buffer;
+    input_t *send_data = get_send_data(slot, inproc_request, send_buffer, 1 + send_header.n_speculative);
+    send_data[0].black_board = board.get_black_board();
+    send_data[0].white_board = board.get_white_board();
+    send_data[0].side = side;
+    send_data[0].depth = depth;
+    send_data[0].player = current_player;
+    send_data[0].visits = visits;
+    send_data[0].legal_board = 0;
+    for (int j = 0; j < 64; j++) {
+        send_data[0].legal_board |= (BitBoard)legal_flags[j] << j;
+    }
+    std::copy(speculative_inputs.begin(), speculative_inputs.begin() + send_header.n_speculative, send_data + 1);
+    speculative_inputs.clear();
+
+    // auto start = std::chrono::system_clock::now();
+    record_request(send_data, 1 + send_header.n_speculative, send_header.priority);
+    response_header_t recv_header;
+    std::vector<output_t> recv_data_all;
+    exchange(server_sock, slot, inproc_request, send_header, send_data, recv_header, recv_data_all);
+    record_response();
+    const output_t& recv_data = recv_data_all[0];
+
+    n_free = recv_header.n_free;
+    model_generation = recv_header.model_generation;
+    n_evaluation.fetch_add(1 + recv_header.n_evaluated, std::memory_order_relaxed);
+    if (eval_cache.size() + recv_header.n_evaluated > MAX_EVAL_CACHE) {
+        eval_cache.clear();
+    }
+    for (int k = 0; k < recv_header.n_evaluated; k++) {
+        const input_t& input = send_data[1 + k];
+        bool small = (input.player == 0 && use_small_model(input.depth, input.visits));
+        eval_cache[std::make_tuple(input.black_board, input.white_board, input.side, (int)input.player, small)] = recv_data_all[1 + k];
     }
-    assert(retval > 0);
 
     // auto end = std::chrono::system_clock::now();
     // float elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() * 1e-3;
@@ -279,3 +1198,40 @@ void request(int server_sock, const Board& board, const Side side, const std::ve
     std::copy(std::begin(recv_data.priors), std::end(recv_data.priors), priors.begin());
     value = recv_data.value;
 }
+
+void request_inputs(int server_sock, const std::vector<input_t>& inputs, int priority, response_header_t& header, std::vector<output_t>& outputs) {
+    int slot = get_slot(server_sock);
+    inproc_request_t inproc_request;
+    request_header_t send_header;
+    send_header.n_speculative = std::min((int)inputs.size() - 1, MAX_SPECULATIVE);
+    send_header.priority = priority;
+    std::vector<input_t> send_buffer;
+    input_t *send_data = get_send_data(slot, inproc_request, send_buffer, 1 + send_header.n_speculative);
+    std::copy(inputs.begin(), inputs.begin() + 1 + send_header.n_speculative, send_data);
+    exchange(server_sock, slot, inproc_request, send_header, send_data, header, outputs);
+}
+
+void set_player(int player) {
+    current_player = player;
+}
+
+int get_model_generation() {
+    return model_generation;
+}
+
+long get_n_evaluation() {
+    return n_evaluation.load(std::memory_order_relaxed);
+}
+
+int get_speculative_capacity() {
+    const auto& config = get_config();
+    return std::min({n_free, config.n_speculative, MAX_SPECULATIVE});
+}
+
+// positions to be evaluated along with the next request if the server has spare capacity
+void set_speculative(const std::vector<std::tuple<Board, Side>>& positions, int depth, int visits) {
+    speculative_inputs.resize(positions.size());
+    for (unsigned int k = 0; k < positions.size(); k++) {
+        make_input(std::get<0>(positions[k]), std::get<1>(positions[k]), depth, visits, speculative_inputs[k]);
+    }
+}
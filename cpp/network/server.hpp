@@ -2,19 +2,23 @@
 
 #include <unistd.h>
 #include <vector>
+#include <tuple>
 
 #include "board.hpp"
 
 
-#define TIMEOUT_USEC 500
-#define MAX_TIMEOUT 4
+#define MAX_SPECULATIVE 8  // max speculative inputs per request
+#define MAX_EVAL_CACHE 1024
 
 
 typedef struct {
     BitBoard black_board;
     BitBoard white_board;
+    BitBoard legal_board;  // legal actions of side
     Side side;
-    bool legal_flags[64];
+    uint8_t depth;  // depth from search root
+    uint8_t player;  // model of the request (see add_player())
+    int visits;  // visit count of parent node
 } input_t;
 
 typedef struct {
@@ -22,8 +26,29 @@ typedef struct {
     float value;
 } output_t;
 
+typedef struct {
+    int n_speculative;  // number of speculative inputs following the main input
+    int priority;  // PRIORITY_LOW or PRIORITY_HIGH
+} request_header_t;
 
-pid_t create_server_process();
-int connect_to_server();
+typedef struct {
+    int n_evaluated;  // number of speculative outputs following the main output
+    int n_free;  // spare batch capacity per client in the last batch
+    int model_generation;  // reloads of the model of the main input since server start
+} response_header_t;
 
-void request(int server_sock, const Board& board, const Side side, const std::vector<bool>& legal_flags, std::vector<float>& priors, float& value);
+
+pid_t create_server_process();
+int connect_to_server();  // to server process, or to server_address of config if set
+void disconnect_from_server(int server_sock);
+void run_standalone_server(const char *address);  // address : "host:port" or path of unix socket
+
+// evaluate position by the evaluator selected in config (NN server or heuristic)
+void request(int server_sock, const Board& board, const Side side, const std::vector<bool>& legal_flags, std::vector<float>& priors, float& value, int depth = 0, int visits = 0);
+// evaluate inputs as they are (main input followed by speculative inputs, no cache), used to replay traces
+void request_inputs(int server_sock, const std::vector<input_t>& inputs, int priority, response_header_t& header, std::vector<output_t>& outputs);
+void set_player(int player);  // model used by requests of calling thread
+int get_model_generation();  // generation of the model in the last response to calling thread
+long get_n_evaluation();
+int get_speculative_capacity();
+void set_speculative(const std::vector<std::tuple<Board, Side>>& positions, int depth, int visits);
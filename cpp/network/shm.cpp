@@ -0,0 +1,118 @@
+#include <iostream>
+#include <new>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "shm.hpp"
+#include "futex.hpp"
+
+
+// shared-memory transport between clients and inference server
+// clients write inputs into their slot and the server reads them directly into its batch;
+// syscalls are only made to wake up a sleeping peer (eventfd for server, futex for client)
+
+namespace {
+
+typedef struct {
+    std::atomic<uint32_t> server_waiting;  // server sleeps in epoll_wait
+    int n_slot;
+    int event_fd;
+} shm_header_t;
+
+shm_header_t *header = nullptr;
+shm_slot_t *slots = nullptr;
+}
+
+
+void create_shm(int n_slot) {
+    size_t header_size = (sizeof(shm_header_t) + 63) / 64 * 64;
+    size_t size = header_size + sizeof(shm_slot_t) * n_slot;
+    void *addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (addr == MAP_FAILED) {
+        fprintf(stderr, "mmap error %s\n", strerror(errno));
+        exit(-1);
+    }
+
+    header = new(addr) shm_header_t;
+    header->server_waiting = 0;
+    header->n_slot = n_slot;
+    header->event_fd = eventfd(0, EFD_NONBLOCK);
+    if (header->event_fd < 0) {
+        fprintf(stderr, "eventfd error %s\n", strerror(errno));
+        exit(-1);
+    }
+
+    slots = reinterpret_cast<shm_slot_t*>((char*)addr + header_size);
+    for (int i = 0; i < n_slot; i++) {
+        new(&slots[i]) shm_slot_t;
+        slots[i].state = SHM_IDLE;
+        slots[i].client_waiting = 0;
+        slots[i].in_use = 0;
+    }
+}
+
+bool shm_created() {
+    return header != nullptr;
+}
+
+int acquire_shm_slot() {
+    for (int slot = 0; slot < header->n_slot; slot++) {
+        uint32_t expected = 0;
+        if (slots[slot].in_use.compare_exchange_strong(expected, 1)) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+void release_shm_slot(int slot) {
+    slots[slot].state.store(SHM_IDLE);  // a request posted before disconnection is dropped
+    slots[slot].client_waiting.store(0);
+    slots[slot].in_use.store(0);
+}
+
+shm_slot_t& get_shm_slot(int slot) {
+    return slots[slot];
+}
+
+void post_request(int slot) {
+    slots[slot].state.store(SHM_REQUEST);
+    if (header->server_waiting.load()) {  // see set_server_waiting()
+        uint64_t one = 1;
+        if (write(header->event_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            fprintf(stderr, "write error %s\n", strerror(errno));
+            exit(-1);
+        }
+    }
+}
+
+void wait_response(int slot) {
+    shm_slot_t& s = slots[slot];
+    while (s.state.load() != SHM_RESPONSE) {
+        s.client_waiting.store(1);
+        if (s.state.load() != SHM_RESPONSE) {  // check again after announcing sleep
+            futex_wait(s.state, SHM_REQUEST, /*shared=*/true);
+        }
+        s.client_waiting.store(0);
+    }
+}
+
+int get_shm_event_fd() {
+    return header->event_fd;
+}
+
+// server must scan the slots again after setting waiting flag before sleeping
+// (a client posting after that scan sees the flag and notifies by eventfd)
+void set_server_waiting(bool waiting) {
+    header->server_waiting.store(waiting ? 1 : 0);
+}
+
+void post_response(int slot) {
+    shm_slot_t& s = slots[slot];
+    s.state.store(SHM_RESPONSE);
+    if (s.client_waiting.load()) {
+        futex_wake(s.state, /*shared=*/true);
+    }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#include "server.hpp"
+
+
+#define SHM_IDLE 0
+#define SHM_REQUEST 1
+#define SHM_RESPONSE 2
+#define SHM_SPARE_SLOTS 16  // slots for clients connecting after startup
+
+
+// request / response area of one client in shared memory
+typedef struct {
+    std::atomic<uint32_t> state;  // SHM_IDLE -> SHM_REQUEST (client) -> SHM_RESPONSE (server), futex word
+    std::atomic<uint32_t> client_waiting;  // client sleeps on state
+    std::atomic<uint32_t> in_use;  // acquired by a connection (released by server after disconnection)
+    request_header_t request_header;
+    input_t inputs[1 + MAX_SPECULATIVE];  // main input followed by speculative inputs
+    response_header_t response_header;
+    output_t outputs[1 + MAX_SPECULATIVE];
+} shm_slot_t;
+
+
+// must be called before fork()
+void create_shm(int n_slot);
+bool shm_created();
+int acquire_shm_slot();  // -1 if all slots are used
+void release_shm_slot(int slot);  // by server after the client of the slot is disconnected
+shm_slot_t& get_shm_slot(int slot);
+
+// client side
+void post_request(int slot);
+void wait_response(int slot);
+
+// server side
+int get_shm_event_fd();  // readable when a request is posted while server is waiting
+void set_server_waiting(bool waiting);
+void post_response(int slot);
@@ -0,0 +1,102 @@
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include "trace.hpp"
+#include "protocol.hpp"
+#include "config.hpp"
+
+
+namespace {
+std::mutex trace_mutex;
+FILE *trace_fp = NULL;  // opened by the first request
+std::chrono::steady_clock::time_point trace_start;
+std::atomic<uint32_t> n_client(0);
+
+thread_local int client_id = -1;
+thread_local bool has_response = false;
+thread_local std::chrono::steady_clock::time_point last_response;
+
+long since(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point now) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+}
+}
+
+
+void record_request(const input_t *inputs, int n_position, int priority) {
+    const char *fname = get_config().trace_fname;
+    if (fname[0] == '\0') {
+        return;
+    }
+    if (client_id < 0) {
+        client_id = n_client++;
+    }
+    auto now = std::chrono::steady_clock::now();
+
+    thread_local std::vector<char> buf;
+    buf.resize(sizeof(trace_record_t) + sizeof(wire_input_t) * n_position);
+    encode_inputs(inputs, n_position, reinterpret_cast<wire_input_t*>(buf.data() + sizeof(trace_record_t)));
+
+    std::lock_guard<std::mutex> lock(trace_mutex);
+    if (trace_fp == NULL) {
+        trace_fp = fopen(fname, "wb");
+        if (trace_fp == NULL) {
+            fprintf(stderr, "cannot open file \"%s\"\n", fname);
+            exit(-1);
+        }
+        trace_start = now;
+    }
+    trace_record_t record = {since(trace_start, now), has_response ? since(last_response, now) : -1, (uint32_t)client_id, (uint8_t)priority, (uint8_t)n_position};
+    memcpy(buf.data(), &record, sizeof(trace_record_t));
+    if (fwrite(buf.data(), 1, buf.size(), trace_fp) != buf.size()) {  // flushed by exit
+        fprintf(stderr, "write error %s\n", strerror(errno));
+        exit(-1);
+    }
+}
+
+void record_response() {
+    if (get_config().trace_fname[0] == '\0') {
+        return;
+    }
+    has_response = true;
+    last_response = std::chrono::steady_clock::now();
+}
+
+bool read_trace(const char *fname, std::vector<std::vector<trace_entry_t>>& clients) {
+    FILE *fp = fopen(fname, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "cannot open file \"%s\"\n", fname);
+        return false;
+    }
+    clients.clear();
+    trace_record_t record;
+    std::vector<wire_input_t> wire_inputs;
+    bool ok = true;
+    while (fread(&record, sizeof(trace_record_t), 1, fp) == 1) {
+        if (record.n_position < 1 || record.n_position > 1 + MAX_SPECULATIVE) {
+            fprintf(stderr, "invalid trace record (%d positions)\n", record.n_position);
+            ok = false;
+            break;
+        }
+        wire_inputs.resize(record.n_position);
+        if (fread(wire_inputs.data(), sizeof(wire_input_t), record.n_position, fp) != record.n_position) {
+            fprintf(stderr, "truncated trace record\n");
+            ok = false;
+            break;
+        }
+        if (record.client >= clients.size()) {
+            clients.resize(record.client + 1);
+        }
+        trace_entry_t entry;
+        entry.record = record;
+        entry.inputs.resize(record.n_position);
+        decode_inputs(wire_inputs.data(), record.n_position, entry.inputs.data());
+        clients[record.client].push_back(entry);
+    }
+    fclose(fp);
+    return ok;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+
+#include "server.hpp"
+
+
+// trace of requests of a client process, written to "trace_file" of config and replayed by server_bench
+// file : sequence of trace_record_t, each followed by n_position x wire_input_t (see protocol.hpp)
+
+typedef struct __attribute__((packed)) {
+    int64_t usec;  // send time since the first request of the process
+    int64_t think_usec;  // since the response to the previous request of the client (-1: first request)
+    uint32_t client;  // client thread of the process
+    uint8_t priority;
+    uint8_t n_position;  // main input followed by speculative inputs
+} trace_record_t;
+
+typedef struct {
+    trace_record_t record;
+    std::vector<input_t> inputs;
+} trace_entry_t;
+
+
+// no-op unless trace_file is set in config
+void record_request(const input_t *inputs, int n_position, int priority);
+void record_response();
+
+// requests of each client in order of sending, return false if file is broken
+bool read_trace(const char *fname, std::vector<std::vector<trace_entry_t>>& clients);
@@ -5,11 +5,13 @@
 #include <cstdlib>
 #include <cassert>
 #include <cstring>
+#include <chrono>
 #include <unistd.h>
 #include <getopt.h>
 
 #include "node.hpp"
 #include "mcts.hpp"
+#include "engine.hpp"
 #include "server.hpp"
 #include "misc.hpp"
 #include "config.hpp"
@@ -17,9 +19,10 @@
 
 int main(int argc, char *argv[]) {
     if ((argc < 2) || (argc > 2 && argv[2][0] != '-')) {
-        fprintf(stderr, "Usage: play exp_id [--generation=G] [--n_simulation=N] [--device_id=ID] [--record_fname=NAME]\n");
+        fprintf(stderr, "Usage: play exp_id [--generation=G] [--n_simulation=N] [--device_id=ID] [--record_fname=NAME] [--engine] [--session] [--server=ADDRESS]\n");
         exit(-1);
     }
+    auto startup_start = std::chrono::system_clock::now();
     int exp_id = atoi(argv[1]);
     std::cout << "exp_id = " << exp_id << std::endl;
 
@@ -31,6 +34,9 @@ int main(int argc, char *argv[]) {
     int n_simulation = 400;
     char record_fname[100] = "./record.txt";
     int device_id = 0;
+    bool engine_mode = false;
+    bool session_mode = false;  // play games until stdin is closed
+    const char *server_address = NULL;  // if set, requests go to a shared inference server
 
     int opt, longindex;
     const struct option longopts[] = {
@@ -38,9 +44,12 @@ int main(int argc, char *argv[]) {
         {"n_simulation", required_argument, NULL, 'n'},
         {"device_id", required_argument, NULL, 'd'},
         {"record_fname", required_argument, NULL, 'r'},
+        {"engine", no_argument, NULL, 'e'},
+        {"session", no_argument, NULL, 's'},
+        {"server", required_argument, NULL, 'a'},
         {0, 0, 0, 0}
     };
-    while ((opt = getopt_long(argc, argv, "g:n:d:r:", longopts, &longindex)) != -1) {
+    while ((opt = getopt_long(argc, argv, "g:n:d:r:esa:", longopts, &longindex)) != -1) {
         switch (opt) {
             case 'g':
                 generation = atoi(optarg);
@@ -54,6 +63,15 @@ int main(int argc, char *argv[]) {
             case 'r':
                 strcpy(record_fname, optarg);
                 break;
+            case 'e':
+                engine_mode = true;
+                break;
+            case 's':
+                session_mode = true;
+                break;
+            case 'a':
+                server_address = optarg;
+                break;
             default:
                 fprintf(stderr, "unknown option\n");
                 exit(-1);
@@ -67,119 +85,161 @@ int main(int argc, char *argv[]) {
     init_config(exp_path, generation, device_id);
     // overwrite experiment configuration
     set_config(/*n_thread=*/1, n_simulation, /*e_frac=*/0.0);
+    if (server_address != NULL) {  // inference server started by inference_server (see README)
+        std::cout << "server = " << server_address << std::endl;
+        set_server_address(server_address);
+    }
+    set_priority(PRIORITY_HIGH);  // a human is waiting, do not queue behind self-play batches
     const auto& config = get_config();
 
-    std::ofstream file(record_fname);
-
     pid_t server_pid = create_server_process();
     (void)server_pid;
     int server_sock = connect_to_server();  // NN server
 
-    std::string input;
-    std::cout << "valid actions : position (e.g. a1) / back / pass" << std::endl;
-    std::cout << "@ [b]lack / [w]hite ?" << std::endl;
-    std::cin >> input;
-
-    Side player_side;
-    Side comp_side;
-    if (input == "b") {
-        player_side = Side::BLACK;
-    } else if (input == "w") {
-        player_side = Side::WHITE;
-    } else {
-        std::cerr << "invalid input " << input << std::endl;
-        exit(-1);
+    if (engine_mode) {  // line-based protocol (see engine.cpp)
+        run_engine(server_sock);
+        disconnect_from_server(server_sock);
+        return 0;
     }
-    comp_side = flip_side(player_side);
+
+    std::ofstream file(record_fname);
+
+    auto startup_end = std::chrono::system_clock::now();
+    int startup_msec = std::chrono::duration_cast<std::chrono::milliseconds>(startup_end - startup_start).count();
+    std::cout << "@ startup : " << startup_msec << " msec" << std::endl;
 
     std::random_device seed_gen;
     std::default_random_engine engine(seed_gen());
-    std::vector<GameNode*> history;
-
-    Board board;
-    Side side = Side::BLACK;
-    GameNode* root = new GameNode(board, Side::BLACK, 0);
-    root->expand(server_sock);
-    root->backpropagete(root->value(), root);
-
-    GameNode *current_node = root;
-    std::cout << "\n" << current_node->board() << std::endl;
-    history.push_back(current_node);
-
-    Action action;
-    for (int move_count = 0;; move_count++) {
-        std::cout << "side : " << side << std::endl;
-
-        if (side == comp_side) {
-            float tau = (move_count < config.e_step) ? config.tau : 0.0;
-            current_node = run_mcts(current_node, tau, server_sock, engine);
-            history.push_back(current_node);
-            action = current_node->parent()->action();
-            std::cout << "@ action : " << action << "\n";
+
+    std::string input;
+    std::cout << "valid actions : position (e.g. a1) / back / pass" << (session_mode ? " / reset" : "") << std::endl;
+
+    // in session mode, games are played until stdin is closed
+    for (int game_count = 0; game_count == 0 || session_mode; game_count++) {
+        std::cout << "@ [b]lack / [w]hite ?" << std::endl;
+        if (!(std::cin >> input)) {  // end of session
+            break;
+        }
+
+        Side player_side;
+        Side comp_side;
+        if (input == "b") {
+            player_side = Side::BLACK;
+        } else if (input == "w") {
+            player_side = Side::WHITE;
         } else {
-            while (true) {
-                std::cout << "@ action ?\n";
-                std::cin >> input;
-                action = parse_action(input);
-                if (!current_node->board().is_legal_action(action, side)) {
-                    std::cout << "invalid action \"" << input << "\"\n";
-                } else {
+            std::cerr << "invalid input " << input << std::endl;
+            exit(-1);
+        }
+        comp_side = flip_side(player_side);
+
+        auto game_start = std::chrono::system_clock::now();
+        std::vector<GameNode*> history;
+
+        Board board;
+        Side side = Side::BLACK;
+        GameNode* root = new GameNode(board, Side::BLACK, 0);
+        root->expand(server_sock);
+        root->backpropagete(root->value(), root);
+
+        GameNode *current_node = root;
+        std::cout << "\n" << current_node->board() << std::endl;
+        history.push_back(current_node);
+
+        Action action;
+        bool reset = false;
+        for (int move_count = 0;; move_count++) {
+            std::cout << "side : " << side << std::endl;
+
+            if (side == comp_side) {
+                float tau = (move_count < config.e_step) ? config.tau : 0.0;
+                current_node = run_mcts(current_node, tau, server_sock, engine);
+                history.push_back(current_node);
+                action = current_node->parent()->action();
+                std::cout << "@ action : " << action << "\n";
+            } else {
+                while (true) {
+                    std::cout << "@ action ?\n";
+                    if (!(std::cin >> input) || (session_mode && input == "reset")) {
+                        reset = true;
+                        break;
+                    }
+                    action = parse_action(input);
+                    if (!current_node->board().is_legal_action(action, side)) {
+                        std::cout << "invalid action \"" << input << "\"\n";
+                    } else {
+                        break;
+                    }
+                }
+                if (reset) {  // abandon this game
                     break;
                 }
-            }
 
-            if (action == SpetialAction::PASS) {
-                current_node = current_node->children()[0];
-            } else if (action == SpetialAction::BACK) {
-                current_node = current_node->parent()->parent();
-                // re-create children
-                for (auto& child : current_node->children_()) {
-                    safe_delete(child);
-                }
-                current_node->children_().clear();
-
-                // std::vector<float> priors(64);  // re-calculate priors
-                // float value;  // not used
-                // request(server_sock, current_node->board(), current_node->side(), current_node->legal_flags(), priors, value);
-                // current_node->add_children(priors);
-                current_node->expand(server_sock);
-                // do not flip side in this case
-                side = flip_side(side);
-            } else {
-                unsigned int selected = 64;
-                auto& legal_actions = current_node->legal_actions();
-                for (unsigned int i = 0; i < legal_actions.size(); i++) {
-                    if (legal_actions[i] == action) {
-                        selected = i;
-                        break;
+                if (action == SpetialAction::PASS) {
+                    current_node = current_node->children()[0];
+                } else if (action == SpetialAction::BACK) {
+                    current_node = current_node->parent()->parent();
+                    // re-create children
+                    for (auto& child : current_node->children_()) {
+                        safe_delete(child);
                     }
+                    current_node->children_().clear();
+
+                    // std::vector<float> priors(64);  // re-calculate priors
+                    // float value;  // not used
+                    // request(server_sock, current_node->board(), current_node->side(), current_node->legal_flags(), priors, value);
+                    // current_node->add_children(priors);
+                    current_node->expand(server_sock);
+                    // do not flip side in this case
+                    side = flip_side(side);
+                } else {
+                    unsigned int selected = 64;
+                    auto& legal_actions = current_node->legal_actions();
+                    for (unsigned int i = 0; i < legal_actions.size(); i++) {
+                        if (legal_actions[i] == action) {
+                            selected = i;
+                            break;
+                        }
+                    }
+                    assert(selected < legal_actions.size());
+                    current_node = current_node->children()[selected];
+                }
+
+                if (!current_node->expanded()) {
+                    current_node->expand(server_sock);
+                    current_node->backpropagete(current_node->value(), current_node);
                 }
-                assert(selected < legal_actions.size());
-                current_node = current_node->children()[selected];
             }
 
-            if (!current_node->expanded()) {
-                current_node->expand(server_sock);
-                current_node->backpropagete(current_node->value(), current_node);
+            std::cout << "\n" << *current_node << "\n";
+            file << action << "\n";
+            file.flush();
+            if (current_node->terminal()) {
+                break;
             }
+            side = flip_side(side);
         }
 
-        std::cout << "\n" << *current_node << "\n";
-        file << action << "\n";
-        file.flush();
-        if (current_node->terminal()) {
-            break;
+        if (!reset) {
+            int count_b = current_node->board().count(CellState::BLACK);
+            int count_w = current_node->board().count(CellState::WHITE);
+            float mlresult = current_node->board().get_result(player_side);
+            std::cout << "@ result : black=" << count_b << " white=" << count_w << std::endl;
+            std::cout << "mlresult=" << mlresult << std::endl;
         }
-        side = flip_side(side);
-    }
 
-    int count_b = current_node->board().count(CellState::BLACK);
-    int count_w = current_node->board().count(CellState::WHITE);
-    float mlresult = current_node->board().get_result(player_side);
-    std::cout << "@ result : black=" << count_b << " white=" << count_w << std::endl;
-    std::cout << "mlresult=" << mlresult << std::endl;
+        auto game_end = std::chrono::system_clock::now();
+        int game_msec = std::chrono::duration_cast<std::chrono::milliseconds>(game_end - game_start).count();
+        std::cout << "@ game time : " << game_msec << " msec" << std::endl;
+
+        if (session_mode) {
+            file << "\n";  // separate games
+        }
+        safe_delete(root);  // delete root -> whole tree
+    }
 
     file.close();
+    disconnect_from_server(server_sock);
 
     return 0;
 }
@@ -0,0 +1,204 @@
+#include <iostream>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "node.hpp"
+#include "mcts.hpp"
+#include "mldata.hpp"
+#include "server.hpp"
+#include "misc.hpp"
+#include "config.hpp"
+
+
+// re-search positions in mldata file with current model and write entries with fresh posteriors and Q
+// (result and action are kept, entries are written in the same order as input)
+
+namespace {
+
+std::mutex input_mutex;
+std::mutex output_mutex;
+FILE *input_fp;
+FILE *output_fp;
+long next_index = 0;
+long n_done = 0;
+
+// return index of entry or -1 if no entry remains
+long read_entry(entry_t& entry) {
+    std::lock_guard<std::mutex> lock(input_mutex);
+    if (fread(&entry, sizeof(entry_t), 1, input_fp) != 1) {
+        return -1;
+    }
+    return next_index++;
+}
+
+void write_entry(long index, const entry_t& entry) {
+    std::lock_guard<std::mutex> lock(output_mutex);
+    fseek(output_fp, index * sizeof(entry_t), SEEK_SET);
+    if (fwrite(&entry, sizeof(entry_t), 1, output_fp) != 1) {
+        fprintf(stderr, "write error %s\n", strerror(errno));
+        exit(-1);
+    }
+    n_done++;
+}
+
+void reanalyse_entry(entry_t& entry, int server_sock) {
+    const auto& config = get_config();
+
+    Board board(entry.black_bitboard, entry.white_bitboard);
+    GameNode *root = new GameNode(board, entry.side, 0);
+    root->expand(server_sock);
+    root->backpropagete(root->value(), root);
+
+    if (root->terminal() || root->pass()) {  // nothing to learn
+        safe_delete(root);
+        return;
+    }
+
+    for (int sim_count = 0; sim_count < config.n_simulation && !root->solved(); sim_count++) {
+        simulate(root, server_sock);
+    }
+
+    // posterior = visit distribution (proven winning move if any)
+    const auto& children = root->children();
+    const auto& legal_actions = root->legal_actions();
+    std::fill(std::begin(entry.posteriors), std::end(entry.posteriors), 0);
+    int N_sum = 0;
+    for (unsigned int i = 0; i < children.size(); i++) {
+        if (children[i]->proof() == Proof::LOSS) {
+            std::fill(std::begin(entry.posteriors), std::end(entry.posteriors), 0);
+            entry.posteriors[legal_actions[i]] = 1.0;
+            N_sum = 0;
+            break;
+        }
+        entry.posteriors[legal_actions[i]] = children[i]->N();
+        N_sum += children[i]->N();
+    }
+    for (unsigned int i = 0; i < children.size() && N_sum > 0; i++) {
+        entry.posteriors[legal_actions[i]] /= N_sum;
+    }
+    entry.Q = root->Q();
+
+    safe_delete(root);  // delete root -> whole tree
+}
+
+void reanalyse(int thread_id, long n_entry) {
+    int server_sock = connect_to_server();  // NN server
+
+    auto start = std::chrono::system_clock::now();
+
+    entry_t entry;
+    long index;
+    while ((index = read_entry(entry)) >= 0) {
+        reanalyse_entry(entry, server_sock);
+        write_entry(index, entry);
+
+        if (thread_id == 0 && index % 1000 == 0) {
+            auto end = std::chrono::system_clock::now();
+            float elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() * 1e-3;
+            printf("%ld / %ld entries (%.1f entries/sec)\n", n_done, n_entry, n_done / elapsed);
+        }
+    }
+
+    disconnect_from_server(server_sock);
+}
+
+}  // namespace
+
+
+int main(int argc, char *argv[]) {
+    if ((argc < 4) || (argc > 4 && argv[4][0] != '-')) {
+        fprintf(stderr, "Usage: reanalyse exp_id input_file output_file [--n_simulation=N] [--n_thread=T] [--device_id=ID]\n");
+        exit(-1);
+    }
+    int exp_id = atoi(argv[1]);
+    const char *input_fname = argv[2];
+    const char *output_fname = argv[3];
+    std::cout << "exp_id = " << exp_id << std::endl;
+
+    char exp_path[100];
+    get_exp_path(argv[0], exp_id, exp_path);
+    std::cout << "exp_path = " << exp_path << std::endl;
+
+    int n_simulation = -1;  // if -1 use n_simulation of experiment
+    int n_thread = -1;  // if -1 use n_thread of experiment
+    int device_id = 0;
+
+    int opt, longindex;
+    const struct option longopts[] = {
+        {"n_simulation", required_argument, NULL, 'n'},
+        {"n_thread", required_argument, NULL, 't'},
+        {"device_id", required_argument, NULL, 'd'},
+        {0, 0, 0, 0}
+    };
+    while ((opt = getopt_long(argc, argv, "n:t:d:", longopts, &longindex)) != -1) {
+        switch (opt) {
+            case 'n':
+                n_simulation = atoi(optarg);
+                break;
+            case 't':
+                n_thread = atoi(optarg);
+                break;
+            case 'd':
+                device_id = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "unknown option\n");
+                exit(-1);
+        }
+    }
+
+    init_config(exp_path, /*generation=*/-1, device_id);  // use best model
+    const auto& config = get_config();
+    // overwrite experiment configuration
+    set_config((n_thread > 0) ? n_thread : config.n_thread, (n_simulation > 0) ? n_simulation : config.n_simulation, /*e_frac=*/0.0);
+    std::cout << "n_simulation = " << config.n_simulation << std::endl;
+    std::cout << "n_thread = " << config.n_thread << std::endl;
+    std::cout << "device_id = " << device_id << std::endl;
+
+    if (access(output_fname, F_OK) != -1) {
+        fprintf(stderr, "ERROR: data file %s already exists\n", output_fname);
+        exit(-1);
+    }
+    input_fp = fopen(input_fname, "rb");
+    if (!input_fp) {
+        fprintf(stderr, "cannot open file \"%s\"\n", input_fname);
+        exit(-1);
+    }
+    output_fp = fopen(output_fname, "wb");
+    if (!output_fp) {
+        fprintf(stderr, "cannot open file \"%s\"\n", output_fname);
+        exit(-1);
+    }
+    fseek(input_fp, 0, SEEK_END);
+    long n_entry = ftell(input_fp) / sizeof(entry_t);
+    fseek(input_fp, 0, SEEK_SET);
+    std::cout << "entries = " << n_entry << std::endl;
+
+    auto start = std::chrono::system_clock::now();
+
+    pid_t server_pid = create_server_process();
+    (void)server_pid;
+
+    std::vector<std::thread> client_threads(config.n_thread);
+    for (int i = 0; i < config.n_thread; i++) {
+        client_threads[i] = std::thread(reanalyse, i, n_entry);
+    }
+    for (int i = 0; i < config.n_thread; i++) {
+        client_threads[i].join();
+    }
+
+    fclose(input_fp);
+    fclose(output_fp);
+
+    auto end = std::chrono::system_clock::now();
+    float elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() * 1e-3;
+    printf("reanalysed %ld entries in %.2f sec (%.1f entries/sec)\n", n_done, elapsed, n_done / elapsed);
+
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <getopt.h>
+
+#include "server.hpp"
+#include "trace.hpp"
+#include "misc.hpp"
+#include "config.hpp"
+
+
+// replay a request trace ("trace_file" in config.json of self-play) against the inference server
+// synthetic client i replays the requests of client (i % clients in trace) one at a time,
+// waiting the recorded think time after each response (or not at all with --fast)
+// batch fill is printed by the server at exit (own server) or exported with its metrics (--server)
+
+namespace {
+
+typedef struct {
+    long usec;  // from sending the request until its response
+    int priority;
+} sample_t;
+
+std::atomic<long> n_position(0);  // sent including speculative inputs
+std::atomic<long> n_evaluated(0);
+
+void replay(const std::vector<trace_entry_t>& entries, bool fast, std::chrono::steady_clock::time_point start, std::vector<sample_t>& samples) {
+    int server_sock = connect_to_server();  // NN server
+
+    response_header_t header;
+    std::vector<output_t> outputs;
+    for (unsigned int i = 0; i < entries.size(); i++) {
+        const trace_record_t& record = entries[i].record;
+        if (!fast && i == 0) {
+            std::this_thread::sleep_until(start + std::chrono::microseconds(record.usec));
+        } else if (!fast && record.think_usec > 0) {
+            std::this_thread::sleep_for(std::chrono::microseconds(record.think_usec));
+        }
+        auto send = std::chrono::steady_clock::now();
+        request_inputs(server_sock, entries[i].inputs, record.priority, header, outputs);
+        long usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - send).count();
+        samples.push_back({usec, record.priority});
+        n_position += entries[i].inputs.size();
+        n_evaluated += 1 + header.n_evaluated;
+    }
+
+    disconnect_from_server(server_sock);
+}
+
+void print_latency(const char *name, std::vector<long>& usecs) {
+    if (usecs.empty()) {
+        return;
+    }
+    std::sort(usecs.begin(), usecs.end());
+    auto percentile = [&](float q) { return usecs[std::min((size_t)(q * usecs.size()), usecs.size() - 1)]; };
+    long sum = 0;
+    for (long usec : usecs) {
+        sum += usec;
+    }
+    printf("latency %-4s n=%zu mean=%ld p50=%ld p90=%ld p99=%ld max=%ld usec\n",
+           name, usecs.size(), sum / (long)usecs.size(), percentile(0.5), percentile(0.9), percentile(0.99), usecs.back());
+}
+
+}  // namespace
+
+
+int main(int argc, char *argv[]) {
+    if ((argc < 3) || (argc > 3 && argv[3][0] != '-')) {
+        fprintf(stderr, "Usage: server_bench exp_id trace_file [--n_client=N] [--fast] [--server=ADDRESS] [--generation=G] [--device_id=ID]\n");
+        exit(-1);
+    }
+    int exp_id = atoi(argv[1]);
+    const char *trace_fname = argv[2];
+    std::cout << "exp_id = " << exp_id << std::endl;
+
+    char exp_path[100];
+    get_exp_path(argv[0], exp_id, exp_path);
+    std::cout << "exp_path = " << exp_path << std::endl;
+
+    int n_client = -1;  // if -1 clients in trace
+    bool fast = false;  // send next request as soon as response arrives
+    const char *server_address = NULL;  // if set, replay against a server started by inference_server
+    int generation = -1;  // if -1 select best model
+    int device_id = 0;
+
+    int opt, longindex;
+    const struct option longopts[] = {
+        {"n_client", required_argument, NULL, 'c'},
+        {"fast", no_argument, NULL, 'f'},
+        {"server", required_argument, NULL, 's'},
+        {"generation", required_argument, NULL, 'g'},
+        {"device_id", required_argument, NULL, 'd'},
+        {0, 0, 0, 0}
+    };
+    while ((opt = getopt_long(argc, argv, "c:fs:g:d:", longopts, &longindex)) != -1) {
+        switch (opt) {
+            case 'c':
+                n_client = atoi(optarg);
+                break;
+            case 'f':
+                fast = true;
+                break;
+            case 's':
+                server_address = optarg;
+                break;
+            case 'g':
+                generation = atoi(optarg);
+                break;
+            case 'd':
+                device_id = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "unknown option\n");
+                exit(-1);
+        }
+    }
+
+    std::vector<std::vector<trace_entry_t>> trace;
+    if (!read_trace(trace_fname, trace) || trace.empty()) {
+        fprintf(stderr, "no requests in trace \"%s\"\n", trace_fname);
+        exit(-1);
+    }
+    long n_request = 0;
+    for (auto& entries : trace) {
+        for (auto& entry : entries) {
+            for (auto& input : entry.inputs) {  // only one model is served
+                input.player = 0;
+            }
+        }
+        n_request += entries.size();
+    }
+    if (n_client < 0) {
+        n_client = trace.size();
+    }
+    std::cout << "trace = " << trace_fname << " (" << trace.size() << " clients, " << n_request << " requests)" << std::endl;
+    std::cout << "n_client = " << n_client << std::endl;
+    std::cout << "timing = " << (fast ? "fast" : "recorded") << std::endl;
+
+    init_config(exp_path, generation, device_id);
+    // one batch row per synthetic client
+    set_config(n_client, get_config().n_simulation, /*e_frac=*/0.0);
+    if (server_address != NULL) {
+        std::cout << "server = " << server_address << std::endl;
+        set_server_address(server_address);
+    }
+
+    pid_t server_pid = create_server_process();
+
+    std::vector<std::vector<sample_t>> samples(n_client);
+    std::vector<std::thread> client_threads(n_client);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n_client; i++) {
+        client_threads[i] = std::thread(replay, std::cref(trace[i % trace.size()]), fast, start, std::ref(samples[i]));
+    }
+    for (int i = 0; i < n_client; i++) {
+        client_threads[i].join();
+    }
+    float elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() * 1e-6;
+
+    std::vector<long> all_usecs;
+    std::vector<long> class_usecs[N_PRIORITY];
+    for (const auto& client_samples : samples) {
+        for (const auto& sample : client_samples) {
+            all_usecs.push_back(sample.usec);
+            class_usecs[sample.priority == PRIORITY_HIGH ? PRIORITY_HIGH : PRIORITY_LOW].push_back(sample.usec);
+        }
+    }
+    printf("requests=%zu positions=%ld evaluated=%ld time=%.2fs\n", all_usecs.size(), n_position.load(), n_evaluated.load(), elapsed);
+    printf("throughput %.1f requests/sec %.1f positions/sec\n", all_usecs.size() / elapsed, n_evaluated.load() / elapsed);
+    print_latency("all", all_usecs);
+    if (!class_usecs[PRIORITY_HIGH].empty()) {
+        print_latency("low", class_usecs[PRIORITY_LOW]);
+        print_latency("high", class_usecs[PRIORITY_HIGH]);
+    }
+    fflush(stdout);
+
+    if (server_pid > 0) {  // batch fill is printed by server after all clients leave
+        waitpid(server_pid, NULL, 0);
+    } else if (server_address != NULL) {
+        printf("batch fill : see metrics of the server\n");
+    }
+    return 0;
+}
@@ -0,0 +1,461 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+
+#include "board.hpp"
+#include "misc.hpp"
+
+
+// exact endgame solver (parallel alpha-beta with young brothers wait and shared transposition table)
+// younger brothers of split points are searched by a pool of n_thread - 1 helper threads
+// position file : one position per line "<64 cells (X: black, O: white, -: empty)> <side (X/O)> [expected score]"
+//                 cells are in order a1, b1, ..., h1, a2, ..., h8; lines starting with '#' are ignored
+// score : final disk difference from the viewpoint of side to move (empty cells go to the winner)
+
+namespace {
+
+const int TT_BITS = 22;  // 4M entries
+const int TT_LOCK_BITS = 12;
+const int TT_MIN_EMPTIES = 7;  // do not store shallow nodes
+const int ORDER_MIN_EMPTIES = 6;  // order moves by mobility only at deep nodes
+const int SPLIT_MIN_EMPTIES = 12;  // search younger brothers in parallel only at deep nodes
+const int SCORE_INF = 65;
+
+typedef struct {
+    BitBoard black_board;
+    BitBoard white_board;
+    Side side;
+    int8_t lower;
+    int8_t upper;
+    Action best;
+} tt_entry_t;
+
+std::vector<tt_entry_t> tt(1 << TT_BITS);
+std::vector<std::mutex> tt_locks(1 << TT_LOCK_BITS);
+
+std::atomic<int> n_idle(0);  // helper threads waiting for a split point
+std::atomic<long> n_node(0);
+
+// state shared by siblings searched in parallel
+struct split_t {
+    const split_t *parent;
+    std::atomic<bool> cutoff;
+    // younger brothers (next and n_running are guarded by pool_mutex)
+    const Board *board;
+    Side side;
+    const std::vector<Action> *actions;
+    unsigned int next;  // next action to be taken
+    int n_running;  // actions being searched
+    // result of the node (guarded by mutex)
+    std::mutex mutex;
+    int alpha;
+    int beta;
+    int best_score;
+    Action best;
+};
+
+// helper pool
+std::mutex pool_mutex;
+std::condition_variable pool_cv;  // notified when a split point is opened or a task is finished
+std::vector<split_t*> open_splits;  // split points with actions left
+bool pool_closing = false;
+
+uint64_t hash_position(const Board& board, Side side) {
+    uint64_t h = board.get_black_board() * 0x9e3779b97f4a7c15ULL;
+    h ^= (board.get_white_board() + (uint64_t)side) * 0xc2b2ae3d27d4eb4fULL;
+    return h ^ (h >> 29);
+}
+
+bool probe(const Board& board, Side side, uint64_t hash, tt_entry_t& entry) {
+    uint64_t idx = hash & ((1 << TT_BITS) - 1);
+    std::lock_guard<std::mutex> lock(tt_locks[idx & ((1 << TT_LOCK_BITS) - 1)]);
+    const tt_entry_t& e = tt[idx];
+    if (e.black_board == board.get_black_board() && e.white_board == board.get_white_board() && e.side == side && e.best != SpetialAction::INVALID) {
+        entry = e;
+        return true;
+    }
+    return false;
+}
+
+void store(const Board& board, Side side, uint64_t hash, int alpha, int beta, int score, Action best) {
+    uint64_t idx = hash & ((1 << TT_BITS) - 1);
+    std::lock_guard<std::mutex> lock(tt_locks[idx & ((1 << TT_LOCK_BITS) - 1)]);
+    tt_entry_t& e = tt[idx];
+    if (!(e.black_board == board.get_black_board() && e.white_board == board.get_white_board() && e.side == side)) {
+        e.black_board = board.get_black_board();
+        e.white_board = board.get_white_board();
+        e.side = side;
+        e.lower = -SCORE_INF;
+        e.upper = SCORE_INF;
+    }
+    if (score > alpha) {
+        e.lower = std::max((int)e.lower, score);
+    }
+    if (score < beta) {
+        e.upper = std::min((int)e.upper, score);
+    }
+    e.best = best;
+}
+
+bool aborted(const split_t *split) {
+    for (const split_t *s = split; s; s = s->parent) {
+        if (s->cutoff.load(std::memory_order_relaxed)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int final_score(const Board& board, Side side) {
+    int player = bit_count(board.get_player_board(side));
+    int opponent = bit_count(board.get_opponent_board(side));
+    int empty = 64 - player - opponent;
+    if (player > opponent) {
+        return player - opponent + empty;
+    } else if (player < opponent) {
+        return player - opponent - empty;
+    }
+    return 0;
+}
+
+int search(const Board& board, Side side, int alpha, int beta, bool passed, const split_t *split, long& nodes, Action *best_action = nullptr);
+
+// search one child and update best score, return true if beta cutoff
+bool search_child(const Board& board, Side side, Action action, int& alpha, int beta, int& best_score, Action& best, const split_t *split, long& nodes) {
+    Board child(board);
+    child.place_disk(action, side);
+    int score = -search(child, flip_side(side), -beta, -alpha, false, split, nodes);
+    if (score > best_score) {
+        best_score = score;
+        best = action;
+        alpha = std::max(alpha, score);
+    }
+    return score >= beta;
+}
+
+// take the next action of a split point (pool_mutex is held), return false if none is left
+bool take_action(split_t *sp, Action& action) {
+    if (sp->next >= sp->actions->size() || aborted(sp)) {
+        open_splits.erase(std::remove(open_splits.begin(), open_splits.end(), sp), open_splits.end());
+        return false;
+    }
+    action = (*sp->actions)[sp->next++];
+    sp->n_running++;
+    return true;
+}
+
+// search a younger brother with the alpha of the split point at start
+void search_split_child(split_t& sp, Action action, long& nodes) {
+    int task_alpha;
+    {
+        std::lock_guard<std::mutex> lock(sp.mutex);
+        task_alpha = sp.alpha;
+    }
+    int task_best_score = -SCORE_INF;
+    Action task_best = action;
+    search_child(*sp.board, sp.side, action, task_alpha, sp.beta, task_best_score, task_best, &sp, nodes);
+    if (!aborted(&sp)) {
+        std::lock_guard<std::mutex> lock(sp.mutex);
+        if (task_best_score > sp.best_score) {
+            sp.best_score = task_best_score;
+            sp.best = task_best;
+            sp.alpha = std::max(sp.alpha, task_best_score);
+        }
+        if (task_best_score >= sp.beta) {
+            sp.cutoff = true;
+        }
+    }
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    sp.n_running--;
+}
+
+void run_helper() {
+    while (true) {
+        split_t *sp = nullptr;
+        Action action;
+        {
+            std::unique_lock<std::mutex> lock(pool_mutex);
+            pool_cv.wait(lock, [&] {
+                while (!open_splits.empty()) {
+                    if (take_action(open_splits.front(), action)) {
+                        sp = open_splits.front();
+                        return true;
+                    }
+                }
+                return pool_closing;
+            });
+            if (sp == nullptr) {  // closing
+                break;
+            }
+            n_idle--;
+        }
+        long nodes = 0;
+        search_split_child(*sp, action, nodes);
+        n_node += nodes;
+        n_idle++;
+        pool_cv.notify_all();  // owner of the split point may wait for this task
+    }
+}
+
+int search(const Board& board, Side side, int alpha, int beta, bool passed, const split_t *split, long& nodes, Action *best_action) {
+    nodes++;
+    BitBoard legal_board = board.make_legal_board(side);
+    int empties = 64 - board.get_disk_num();
+
+    if (legal_board == 0) {
+        if (passed || empties == 0) {  // game over
+            return final_score(board, side);
+        }
+        if (best_action) {
+            *best_action = SpetialAction::PASS;
+        }
+        return -search(board, flip_side(side), -beta, -alpha, true, split, nodes);
+    }
+
+    uint64_t hash = 0;
+    tt_entry_t entry;
+    Action tt_best = SpetialAction::INVALID;
+    if (empties >= TT_MIN_EMPTIES) {
+        hash = hash_position(board, side);
+        if (probe(board, side, hash, entry)) {
+            tt_best = entry.best;
+            if (!best_action) {
+                if (entry.lower >= beta) {
+                    return entry.lower;
+                }
+                if (entry.upper <= alpha) {
+                    return entry.upper;
+                }
+                if (entry.lower == entry.upper) {
+                    return entry.lower;
+                }
+            }
+        }
+    }
+
+    // move ordering: best move of transposition table, then fewest replies (fastest first)
+    std::vector<Action> actions;
+    for (BitBoard b = legal_board; b; b &= b - 1) {
+        actions.push_back(__builtin_ctzll(b));
+    }
+    if (empties >= ORDER_MIN_EMPTIES) {
+        std::vector<std::pair<int, Action>> keys;
+        for (Action action : actions) {
+            Board child(board);
+            child.place_disk(action, side);
+            int key = (action == tt_best) ? -1 : bit_count(child.make_legal_board(flip_side(side)));
+            keys.emplace_back(key, action);
+        }
+        std::sort(keys.begin(), keys.end());
+        for (unsigned int i = 0; i < keys.size(); i++) {
+            actions[i] = keys[i].second;
+        }
+    }
+
+    int alpha_org = alpha;
+    int best_score = -SCORE_INF;
+    Action best = actions[0];
+
+    // eldest brother first
+    bool cut = search_child(board, side, actions[0], alpha, beta, best_score, best, split, nodes);
+
+    if (!cut && actions.size() > 1) {
+        if (empties < SPLIT_MIN_EMPTIES || n_idle.load() <= 0) {
+            for (unsigned int i = 1; i < actions.size() && !aborted(split); i++) {
+                if (search_child(board, side, actions[i], alpha, beta, best_score, best, split, nodes)) {
+                    break;
+                }
+            }
+        } else {
+            // younger brothers in parallel with idle helpers
+            split_t sp;
+            sp.parent = split;
+            sp.cutoff = false;
+            sp.board = &board;
+            sp.side = side;
+            sp.actions = &actions;
+            sp.next = 1;
+            sp.n_running = 0;
+            sp.alpha = alpha;
+            sp.beta = beta;
+            sp.best_score = best_score;
+            sp.best = best;
+            {
+                std::lock_guard<std::mutex> lock(pool_mutex);
+                open_splits.push_back(&sp);
+            }
+            pool_cv.notify_all();
+
+            while (true) {
+                Action action;
+                {
+                    std::lock_guard<std::mutex> lock(pool_mutex);
+                    if (!take_action(&sp, action)) {
+                        break;
+                    }
+                }
+                search_split_child(sp, action, nodes);
+            }
+            {  // wait for actions taken by helpers
+                std::unique_lock<std::mutex> lock(pool_mutex);
+                pool_cv.wait(lock, [&] { return sp.n_running == 0; });
+            }
+            alpha = sp.alpha;
+            best_score = sp.best_score;
+            best = sp.best;
+        }
+    }
+
+    if (aborted(split)) {  // result is meaningless
+        return best_score;
+    }
+    if (empties >= TT_MIN_EMPTIES) {
+        store(board, side, hash, alpha_org, beta, best_score, best);
+    }
+    if (best_action) {
+        *best_action = best;
+    }
+    return best_score;
+}
+
+bool parse_position(const std::string& line, Board& board, Side& side, bool& has_expected, int& expected) {
+    std::istringstream iss(line);
+    std::string cells, side_str;
+    if (!(iss >> cells >> side_str) || cells.size() != 64 || (side_str != "X" && side_str != "O")) {
+        return false;
+    }
+    BitBoard black_board = 0;
+    BitBoard white_board = 0;
+    for (int i = 0; i < 64; i++) {
+        if (cells[i] == 'X') {
+            black_board |= (BitBoard)1 << i;
+        } else if (cells[i] == 'O') {
+            white_board |= (BitBoard)1 << i;
+        } else if (cells[i] != '-') {
+            return false;
+        }
+    }
+    board = Board(black_board, white_board);
+    side = (side_str == "X") ? Side::BLACK : Side::WHITE;
+    has_expected = static_cast<bool>(iss >> expected);
+    return true;
+}
+
+}  // namespace
+
+
+int main(int argc, char *argv[]) {
+    if ((argc < 2) || (argc > 2 && argv[2][0] != '-')) {
+        fprintf(stderr, "Usage: solve position_file [--n_thread=T]\n");
+        exit(-1);
+    }
+    const char *position_fname = argv[1];
+
+    int n_thread = std::thread::hardware_concurrency();
+
+    int opt, longindex;
+    const struct option longopts[] = {
+        {"n_thread", required_argument, NULL, 't'},
+        {0, 0, 0, 0}
+    };
+    while ((opt = getopt_long(argc, argv, "t:", longopts, &longindex)) != -1) {
+        switch (opt) {
+            case 't':
+                n_thread = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "unknown option\n");
+                exit(-1);
+        }
+    }
+    std::cout << "n_thread = " << n_thread << std::endl;
+
+    std::vector<std::thread> helpers;
+    for (int i = 0; i < n_thread - 1; i++) {
+        n_idle++;
+        helpers.emplace_back(run_helper);
+    }
+
+    std::ifstream ifs(position_fname);
+    if (ifs.fail()) {
+        fprintf(stderr, "cannot open file \"%s\"\n", position_fname);
+        exit(-1);
+    }
+
+    long total_nodes = 0;
+    float total_elapsed = 0;
+    int n_position = 0;
+    int n_mismatch = 0;
+
+    std::string line;
+    while (std::getline(ifs, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        Board board;
+        Side side;
+        bool has_expected = false;
+        int expected = 0;
+        if (!parse_position(line, board, side, has_expected, expected)) {
+            fprintf(stderr, "invalid position \"%s\"\n", line.c_str());
+            exit(-1);
+        }
+
+        for (auto& e : tt) {  // solve each position from scratch
+            e.best = SpetialAction::INVALID;
+        }
+        n_node = 0;
+
+        auto start = std::chrono::system_clock::now();
+        long nodes = 0;
+        Action best = SpetialAction::INVALID;
+        int score = search(board, side, -SCORE_INF, SCORE_INF, false, nullptr, nodes, &best);
+        n_node += nodes;
+        auto end = std::chrono::system_clock::now();
+        float elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() * 1e-6;
+
+        n_position++;
+        total_nodes += n_node;
+        total_elapsed += elapsed;
+        std::cout << "#" << n_position
+            << " empties=" << 64 - board.get_disk_num()
+            << " score=" << score
+            << " best=" << best
+            << " nodes=" << n_node
+            << " time=" << elapsed << "s"
+            << " nps=" << (long)(n_node / std::max(elapsed, 1e-6f));
+        if (has_expected) {
+            std::cout << (score == expected ? " ok" : " MISMATCH (expected " + std::to_string(expected) + ")");
+            n_mismatch += (score != expected);
+        }
+        std::cout << std::endl;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex);
+        pool_closing = true;
+    }
+    pool_cv.notify_all();
+    for (auto& helper : helpers) {
+        helper.join();
+    }
+
+    std::cout << "positions=" << n_position
+        << " nodes=" << total_nodes
+        << " time=" << total_elapsed << "s"
+        << " nps=" << (long)(total_nodes / std::max(total_elapsed, 1e-6f))
+        << " mismatch=" << n_mismatch << std::endl;
+
+    return (n_mismatch == 0) ? 0 : 1;
+}
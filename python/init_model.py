@@ -43,8 +43,25 @@ if __name__ == '__main__':
     side_dummy = torch.rand(1)
     legal_flags_dummy = torch.rand(1, config["n_action"])
 
+    omega_net.eval()  # trace BatchNorm with running statistics (folded into convolutions by the server)
     omega_net_jit = torch.jit.trace(omega_net, (black_board_dummy, white_board_dummy, side_dummy, legal_flags_dummy))
     omega_net_jit.save(str(new_model_jit_path))
 
     shutil.copy(new_model_path, best_model_path)
     shutil.copy(new_model_jit_path, best_model_jit_path)
+
+    # small model for deep leaves (see small_depth / small_visits in config)
+    if "small_n_res_block" in config:
+        small_net = OmegaNet(
+            board_size=config["board_size"],
+            n_action=config["n_action"],
+            n_res_block=config["small_n_res_block"],
+            res_filter=config["small_res_filter"],
+            policy_filter=config["policy_filter"],
+            value_filter=config["value_filter"],
+            value_hidden=config["value_hidden"]
+        )
+        torch.save(small_net.state_dict(), model_path / 'small_model_best.pt')
+        small_net.eval()
+        small_net_jit = torch.jit.trace(small_net, (black_board_dummy, white_board_dummy, side_dummy, legal_flags_dummy))
+        small_net_jit.save(str(model_path / 'small_model_jit_best.pt'))
@@ -10,35 +10,39 @@ if __name__ == '__main__':
     parser = argparse.ArgumentParser()
     parser.add_argument("exp_id", type=int)
     parser.add_argument("generation", type=int)
-    parser.add_argument("--n-games", type=int, default=3)
+    parser.add_argument("--n-games", type=int, default=3)  # for each side
+    parser.add_argument("--n-thread", type=int, default=64)
     parser.add_argument("--n-simulation", type=int, default=50)
     parser.add_argument("--threshold", type=int, default=50)
     parser.add_argument("--device-id", type=int, default=0)
     args = parser.parse_args()
 
     root_path = pathlib.Path(__file__).resolve().parents[1]
-    python_path = root_path / "python"
     build_path = root_path / "cpp" / "build"
     exp_path = root_path / "exp" / str(args.exp_id)
     model_path = exp_path / "model" / f"model_{args.generation}.pt"
     model_jit_path = exp_path / "model" / f"model_jit_{args.generation}.pt"
     best_model_path = exp_path / "model" / f"model_best.pt"
     best_model_jit_path = exp_path / "model" / f"model_jit_best.pt"
+    # small model trained with the main model (if small_n_res_block is set in config)
+    small_model_path = exp_path / "model" / f"small_model_{args.generation}.pt"
+    small_model_jit_path = exp_path / "model" / f"small_model_jit_{args.generation}.pt"
+    best_small_model_path = exp_path / "model" / f"small_model_best.pt"
+    best_small_model_jit_path = exp_path / "model" / f"small_model_jit_best.pt"
 
     file = open(exp_path / f"ko_record_{args.exp_id}.txt", 'a')
     file.write(f"{args.generation}\n")
 
-    cmd1 = f"{build_path}/play {args.exp_id} --generation {args.generation} --n_simulation {args.n_simulation} --device_id {args.device_id}"
-    cmd2 = f"{build_path}/play {args.exp_id} --n_simulation {args.n_simulation} --device_id {args.device_id}"
+    # games against the best model are played concurrently through one inference server
+    cmd = f"{build_path}/match {args.exp_id} {args.generation} --n_game {args.n_games} --n_simulation {args.n_simulation} --n_thread {args.n_thread} --device_id {args.device_id}"
 
-    update = False
     start = time.time()
 
-    for side1 in ['b', 'w']:
-        cmd = f"python {python_path}/mediator.py \"{cmd1}\" \"{cmd2}\" --n-games {args.n_games} --side {side1} --quiet"
-        print(cmd)
-        result = subprocess.check_output(cmd, shell=True).decode('utf-8')
+    print(cmd)
+    result = subprocess.check_output(cmd, shell=True).decode('utf-8')
 
+    update = True
+    for side1 in ['b', 'w']:
         if side1 == 'b':
             mr = re.search(r"black win rate = ([0-9\.]+) %", result)
         else:
@@ -50,9 +54,7 @@ if __name__ == '__main__':
         file.flush()
 
         if win_rate < args.threshold:
-            break
-        if side1 == 'w':
-            update = True
+            update = False
 
     elapsed = time.time() - start
     print(f"elapsed : {elapsed:.2f} sec")
@@ -62,10 +64,16 @@ if __name__ == '__main__':
         print("update best model")
         shutil.copy(model_path, best_model_path)
         shutil.copy(model_jit_path, best_model_jit_path)
+        if small_model_path.exists():
+            shutil.copy(small_model_path, best_small_model_path)
+            shutil.copy(small_model_jit_path, best_small_model_jit_path)
 
     if args.generation % 10 != 0:  # delete old model
         print(f"unlink {model_path.name}, {model_jit_path.name}")
         model_path.unlink()
         model_jit_path.unlink()
+        if small_model_path.exists():
+            small_model_path.unlink()
+            small_model_jit_path.unlink()
 
     file.close()
@@ -6,11 +6,14 @@
 # 5. output result with "@ result : black=[0-9]+ white=[0-9]+"
 # 6. pass is denoted as "pass" and treated like other actions
 # 7. all prompts and outputs must be followed by "\n"
+# 8. (session mode) prompt side input again after result, exit when stdin is closed
+#    optionally output startup time as "@ startup : [0-9]+ msec"
 # other prompts and outputs are ignored
 
 import argparse
 import subprocess
 import re
+import time
 import glob
 import os
 import numpy as np
@@ -24,7 +27,9 @@ def flip_side(side):
 
 
 def read_until(proc, phrase):
+    # phrase: str or tuple of str (stop at any of them)
     # print(f"read_until {phrase}")
+    phrases = phrase if isinstance(phrase, tuple) else (phrase,)
     contents = ""
     while True:
         line = proc.stdout.readline()
@@ -34,13 +39,26 @@ def read_until(proc, phrase):
 
         contents += line
 
-        if phrase in contents:
+        if any(p in contents for p in phrases):
             break
 
     return contents
 
 
-def play_game(cmd1, cmd2, side1, log_file, quiet):
+def start_programs(cmd1, cmd2):
+    proc1 = subprocess.Popen(cmd1.strip().split(" "), encoding='UTF-8', stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    proc2 = subprocess.Popen(cmd2.strip().split(" "), encoding='UTF-8', stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    return proc1, proc2
+
+
+def stop_programs(procs):
+    for proc in procs:
+        proc.stdin.close()
+    for proc in procs:
+        proc.wait()
+
+
+def play_game(cmd1, cmd2, side1, log_file, quiet, procs=None):
     if side1 == 'b':
         idx2side = {1: 'b', 2: 'w'}
         side2idx = {'b': 1, 'w': 2}
@@ -50,8 +68,11 @@ def play_game(cmd1, cmd2, side1, log_file, quiet):
     else:
         raise RuntimeError(f"side ({side}) is invalid")
 
-    proc1 = subprocess.Popen(cmd1.strip().split(" "), encoding='UTF-8', stdin=subprocess.PIPE, stdout=subprocess.PIPE)
-    proc2 = subprocess.Popen(cmd2.strip().split(" "), encoding='UTF-8', stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    session = procs is not None  # programs are reused across games
+    if session:
+        proc1, proc2 = procs
+    else:
+        proc1, proc2 = start_programs(cmd1, cmd2)
     idx2proc = {1: proc1, 2: proc2}
 
     # new line is necessary for any prompt (otherwise buffered)
@@ -59,11 +80,15 @@ def play_game(cmd1, cmd2, side1, log_file, quiet):
     ACTION_PROMPT = "@ action ?"
     ACTION_OUTPUT = "@ action :"
     RESULT_OUTPUT = "@ result :"
+    STARTUP_OUTPUT = "@ startup :"
 
     for i in [1, 2]:
         # read until side prompt
         contents = read_until(idx2proc[i], SIDE_PROMPT)
         # print(f"proc[{i}] contents = \"{contents}\"")
+        m_startup = re.search(rf"{STARTUP_OUTPUT}\s*([0-9]+) msec", contents)
+        if m_startup:  # reported only once per process
+            print(f"program{i} startup = {m_startup.group(1)} msec")
         # send *player* side (not computer side!)
         idx2proc[i].stdin.write(flip_side(idx2side[i]) + "\n")
         idx2proc[i].stdin.flush()
@@ -76,7 +101,8 @@ def play_game(cmd1, cmd2, side1, log_file, quiet):
         idx_send, idx_recv = side2idx[side], side2idx[flip_side(side)]
 
         # receive action
-        contents = read_until(idx2proc[idx_send], ACTION_OUTPUT)
+        # in session mode the program does not exit after result
+        contents = read_until(idx2proc[idx_send], (ACTION_OUTPUT, RESULT_OUTPUT))
         # print(f"received: \"{contents}\"")
         m_action = re.search(rf"{ACTION_OUTPUT}\s*(\w+)", contents)
 
@@ -127,8 +153,9 @@ def play_game(cmd1, cmd2, side1, log_file, quiet):
         print(f"inconsistent results!")
         exit(-1)
 
-    proc1.wait()
-    proc2.wait()
+    if not session:
+        proc1.wait()
+        proc2.wait()
     return idx2result[1]
 
 
@@ -163,6 +190,7 @@ if __name__ == '__main__':
     parser.add_argument("-n", "--n-games", type=int, default=1, help="number of games to play")
     parser.add_argument("-q", "--quiet", action="store_true")
     parser.add_argument("--side1", type=str)
+    parser.add_argument("-s", "--session", action="store_true", help="play all games with the same programs")
     args = parser.parse_args()
 
     if not args.side1:  # side1 not specified in options
@@ -174,9 +202,18 @@ if __name__ == '__main__':
     log_fname = f"log.txt"
     with open(log_fname, "w") as file:
         results = []
+        procs = None
+        if args.session:
+            procs = start_programs(args.cmd1, args.cmd2)
+        game_times = []
         for i in range(args.n_games):
             print(f"game {i+1}")
-            results.append(play_game(args.cmd1, args.cmd2, side1, file, args.quiet))
+            game_start = time.time()
+            results.append(play_game(args.cmd1, args.cmd2, side1, file, args.quiet, procs))
+            game_times.append(time.time() - game_start)
+        if args.session:
+            stop_programs(procs)
+        print(f"average game time = {np.mean(game_times):.2f} sec")
 
     results = np.array(results, dtype=np.float)
 
@@ -47,6 +47,9 @@ def train(args):
     best_model_path = exp_path / "model" / f"model_best.pt"
     new_model_path = exp_path / "model" / f"model_{args.generation+1}.pt"
     new_model_jit_path = exp_path / "model" / f"model_jit_{args.generation+1}.pt"
+    best_small_model_path = exp_path / "model" / "small_model_best.pt"
+    new_small_model_path = exp_path / "model" / f"small_model_{args.generation+1}.pt"
+    new_small_model_jit_path = exp_path / "model" / f"small_model_jit_{args.generation+1}.pt"
     # optim_path = exp_path / "model" / "optim.pt"
 
     if new_model_path.exists():
@@ -74,6 +77,24 @@ def train(args):
     optim = torch.optim.AdamW(omega_net.parameters(), weight_decay=config["weight_decay"])
     assert omega_net.training
 
+    # small model for deep leaves (see small_depth / small_visits in config) is trained on the same data
+    # and promoted by knockout.py together with the main model of the same generation
+    small_net = None
+    if "small_n_res_block" in config:
+        small_net = OmegaNet(
+            board_size=config["board_size"],
+            n_action=config["n_action"],
+            n_res_block=config["small_n_res_block"],
+            res_filter=config["small_res_filter"],
+            policy_filter=config["policy_filter"],
+            value_filter=config["value_filter"],
+            value_hidden=config["value_hidden"]
+        )
+        small_net.load_state_dict(torch.load(best_small_model_path))
+        print(f"load {best_small_model_path.name}")
+        small_net.to(device)
+        small_optim = torch.optim.AdamW(small_net.parameters(), weight_decay=config["weight_decay"])
+
     # if optim_path.exists():
     #     print(f"load optimizer {optim_path.name}")
     #     optim.load_state_dict(torch.load(optim_path))
@@ -90,6 +111,7 @@ def train(args):
         policy_loss_avg = 0
         value_loss_avg = 0
         entropy_avg = 0
+        small_loss_avg = 0
         # loss_uni_avg = 0
         for black_board_b, white_board_b, side_b, legal_flags_b, result_b, posteriors_b in loader:
             black_board_b = black_board_b.to(device)
@@ -110,6 +132,14 @@ def train(args):
             loss.backward()
             optim.step()
 
+            if small_net is not None:
+                small_policy_logit_b, small_value_pred_b = small_net(black_board_b, white_board_b, side_b, legal_flags_b)
+                small_loss = -(posteriors_b * small_policy_logit_b).sum(dim=1).mean(dim=0) + (small_value_pred_b - result_b).pow(2).mean(dim=0)
+                small_optim.zero_grad()
+                small_loss.backward()
+                small_optim.step()
+                small_loss_avg += small_loss.item() / n_batch
+
             with torch.no_grad():
                 policy_loss_avg += policy_loss.item() / n_batch
                 value_loss_avg += value_loss.item() / n_batch
@@ -117,6 +147,8 @@ def train(args):
 
         elapsed = time.time() - start
         print(f"epoch={e+1}  ({elapsed:.2f} sec)  policy_loss={policy_loss_avg:.3f} (entropy={entropy_avg:.3f}) value_loss={value_loss_avg:.3f}")
+        if small_net is not None:
+            print(f"           small model loss={small_loss_avg:.3f}")
 
 
     omega_net.cpu()
@@ -128,11 +160,20 @@ def train(args):
     white_board_s = white_board_b[:1].cpu()
     side_s = side_b[:1].cpu()
     legal_flags_s = legal_flags_b[:1].cpu()
+    omega_net.eval()  # trace BatchNorm with running statistics (folded into convolutions by the server)
     omega_net_traced = torch.jit.trace(omega_net, (black_board_s, white_board_s, side_s, legal_flags_s))
     omega_net_traced.save(str(new_model_jit_path))
 
     print(f"save model {new_model_path.name}, {new_model_jit_path.name}")
 
+    if small_net is not None:
+        small_net.cpu()
+        torch.save(small_net.state_dict(), new_small_model_path)
+        small_net.eval()
+        small_net_traced = torch.jit.trace(small_net, (black_board_s, white_board_s, side_s, legal_flags_s))
+        small_net_traced.save(str(new_small_model_jit_path))
+        print(f"save model {new_small_model_path.name}, {new_small_model_jit_path.name}")
+
 
 if __name__ == '__main__':
     parser = argparse.ArgumentParser()